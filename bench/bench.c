@@ -0,0 +1,242 @@
+/*
+ * Elevator Control System - cycle-count benchmark
+ * Copyright 2015 Carlton Duffett and Neeraj Basu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Replaces main() with a fixed list of cases. Each case puts the state machine in a known
+ * state, queues one event with a scripted sample of P1IN and P2IN, exactly as a handler
+ * would, and times run_events() on timer A1. Interrupts stay disabled throughout, so the
+ * counts are the event's own code. The results go to bench_cycles[], in the order of
+ * the case list in bench/run.sh, and bench_done() is where the instruction-set simulator
+ * stops to read them out.
+ *
+ * Built for the device by bench/run.sh. Built on the host instead, it runs the same
+ * cases against the simulated register file and prints the state each one ends in, a
+ * quick check that every case still takes the path it is named after:
+ *
+ *  cc -O2 -o bench-host bench/bench.c host/msp430_host.c && ./bench-host
+ */
+
+#define BENCH   1   // main.c leaves main() to us
+
+#include "../main.c"
+
+#ifdef HAL_HOST
+#include <stdio.h>
+#endif
+
+// ================ CASES ================
+
+#define BENCH_CASES     16
+
+unsigned int bench_cycles[BENCH_CASES];
+unsigned char bench_state[BENCH_CASES];     // state after the event
+
+// encoder outputs for one pressed input
+#define TOWER_IN(floor, up) (TOWER_EN | (TOWER_ADDR(floor, up) << TOWER_ADDR_SHIFT))
+#define ELEV_IN(floor)      (ELEV_EN | (((floor) - 1) << ELEV_ADDR_SHIFT))
+#define LIMIT_IN(floor)     (LIMIT_EN | (((floor) - 1) << LIMIT_ADDR_SHIFT))
+
+// put the car at floor (0 while homing) in state s with nothing pending and every input
+// released
+void bench_setup(unsigned char s, unsigned char floor) {
+
+    unsigned char i;
+
+    state = s;
+    current_floor = floor;
+    target_floor = floor;
+    dest_direction = 'u';
+    hall_up_calls = hall_dn_calls = car_calls = 0;
+    dwell = 0;
+    wait_ticks = 0;
+    start_profile();
+
+    for (i = 0; i < INPUTS; i++) {
+        input_code[i] = 0;
+        input_quiet[i] = 0;
+    }
+#if BOOT_CALIBRATION
+    cal_run = CAL_RUNS;
+#endif
+#if DEEP_IDLE
+    deep_idle = 0;
+#endif
+#if INPUT_IRQ
+    P1IE |= TOWER_EN;
+    P2IE |= LIMIT_EN + ELEV_EN;
+#endif
+}
+
+// lines a tick case samples as held: their interrupts are masked, so the tick polls them
+#if INPUT_IRQ
+#define BENCH_HOLD(lines1, lines2)  do { P1IE &= ~(lines1); P2IE &= ~(lines2); } while (0)
+#else
+#define BENCH_HOLD(lines1, lines2)
+#endif
+
+// queue one event and time its handling, in SMCLK cycles
+unsigned int bench_event(unsigned char type, port_sample_t p1, port_sample_t p2) {
+
+    unsigned char i = event_head;
+    unsigned int start;
+
+    event_type[i] = type;
+    event_p1[i] = p1;
+    event_p2[i] = p2;
+    event_head = (i + 1) & EVENT_MASK;
+
+    start = TA1R;
+    run_events();
+    return TA1R - start;
+}
+
+// the simulator stops here once every case has run
+#ifndef HAL_HOST
+__attribute__((noinline))
+#endif
+void bench_done(void) {
+
+#ifndef HAL_HOST
+    __asm__ volatile (""); // a side effect, so the call is not dropped
+#endif
+}
+
+void bench_run(void) {
+
+    unsigned char n = 0;
+
+    // ticks, one per state and path through it
+    bench_setup('i', 0);                            // homing, no switch closed
+    bench_cycles[n] = bench_event(EV_TICK, 0, 0);
+    bench_state[n++] = state;
+
+    bench_setup('c', 2);                            // calibrating, on the way up
+#if BOOT_CALIBRATION
+    cal_run = 0;
+#endif
+    bench_cycles[n] = bench_event(EV_TICK, 0, 0);
+    bench_state[n++] = state;
+
+    bench_setup('x', 1);                            // parked, nothing to do
+    BENCH_HOLD(0, LIMIT_EN);
+    bench_cycles[n] = bench_event(EV_TICK, 0, LIMIT_IN(1));
+    bench_state[n++] = state;
+
+    bench_setup('x', 1);                            // parked, leaves for a hall call
+    hall_dn_calls = FLOOR_BIT(4);
+    BENCH_HOLD(0, LIMIT_EN);
+    bench_cycles[n] = bench_event(EV_TICK, 0, LIMIT_IN(1));
+    bench_state[n++] = state;
+
+    bench_setup('^', 1);                            // on the way to a hall call
+    target_floor = 4;
+    hall_dn_calls = FLOOR_BIT(4);
+    bench_cycles[n] = bench_event(EV_TICK, 0, 0);
+    bench_state[n++] = state;
+
+    bench_setup('v', 3);                            // on the way down to a hall call
+    dest_direction = 'd';
+    target_floor = 1;
+    hall_up_calls = FLOOR_BIT(1);
+    bench_cycles[n] = bench_event(EV_TICK, 0, 0);
+    bench_state[n++] = state;
+
+    bench_setup('u', 2);                            // rider aboard, going up
+    target_floor = 4;
+    car_calls = FLOOR_BIT(4);
+    bench_cycles[n] = bench_event(EV_TICK, 0, 0);
+    bench_state[n++] = state;
+
+    bench_setup('d', 3);                            // rider aboard, going down
+    dest_direction = 'd';
+    target_floor = 1;
+    car_calls = FLOOR_BIT(1);
+    bench_cycles[n] = bench_event(EV_TICK, 0, 0);
+    bench_state[n++] = state;
+
+    bench_setup('w', 2);                            // boarding, dwell running
+    dwell = DWELL_TICKS;
+    BENCH_HOLD(0, LIMIT_EN);
+    bench_cycles[n] = bench_event(EV_TICK, 0, LIMIT_IN(2));
+    bench_state[n++] = state;
+
+    bench_setup('w', 2);                            // boarding over, leaves for a car call
+    car_calls = FLOOR_BIT(4);
+    BENCH_HOLD(0, LIMIT_EN);
+    bench_cycles[n] = bench_event(EV_TICK, 0, LIMIT_IN(2));
+    bench_state[n++] = state;
+
+    // input events, one per encoder and outcome
+    bench_setup('^', 1);                            // passes floor 2 for a call at 4
+    target_floor = 4;
+    hall_up_calls = FLOOR_BIT(4);
+    bench_cycles[n] = bench_event(EV_LIMIT, 0, LIMIT_IN(2));
+    bench_state[n++] = state;
+
+    bench_setup('u', 2);                            // stops at the rider's floor
+    target_floor = 3;
+    car_calls = FLOOR_BIT(3);
+    bench_cycles[n] = bench_event(EV_LIMIT, 0, LIMIT_IN(3));
+    bench_state[n++] = state;
+
+    bench_setup('x', 1);                            // hall call wakes a parked car
+#if DEEP_IDLE
+    deep_idle = 1;
+#endif
+    bench_cycles[n] = bench_event(EV_TOWER, TOWER_IN(3, 0), LIMIT_IN(1));
+    bench_state[n++] = state;
+
+    bench_setup('w', 2);                            // rider picks a floor
+    bench_cycles[n] = bench_event(EV_ELEV, 0, LIMIT_IN(2) | ELEV_IN(4));
+    bench_state[n++] = state;
+
+    bench_setup('v', 3);                            // switch and car button in one sample
+    dest_direction = 'd';
+    target_floor = 1;
+    hall_up_calls = FLOOR_BIT(1);
+    bench_cycles[n] = bench_event(EV_LIMIT + EV_ELEV, 0, LIMIT_IN(2) | ELEV_IN(1));
+    bench_state[n++] = state;
+
+    bench_setup('u', 1);                            // a tick with all three encoders held
+    target_floor = 4;
+    car_calls = FLOOR_BIT(4);
+    BENCH_HOLD(TOWER_EN, LIMIT_EN + ELEV_EN);
+    bench_cycles[n] = bench_event(EV_TICK, TOWER_IN(3, 1), LIMIT_IN(2) | ELEV_IN(3));
+    bench_state[n++] = state;
+
+    bench_done();
+}
+
+int main(void) {
+
+    init_system();
+    _disable_interrupts();  // only the cases run, nothing else
+    bench_run();
+
+#ifdef HAL_HOST
+    {
+        unsigned char i;
+
+        for (i = 0; i < BENCH_CASES; i++) {
+            printf("case %2u: '%c'\n", i, bench_state[i]); // TA1R stands still here
+        }
+    }
+    return 0;
+#else
+    for (;;) {
+        // done, the simulator has already stopped at bench_done()
+    }
+#endif
+}
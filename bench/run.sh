@@ -0,0 +1,84 @@
+#!/bin/sh
+#
+# Elevator Control System - cycle-count benchmark under the mspdebug simulator
+# Copyright 2015 Carlton Duffett and Neeraj Basu
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Experimental: the md parsing and the budget check have only been run on stand-in output,
+# not yet against a real toolchain install.
+#
+# Cross-compiles bench/bench.c (main.c with a scripted main()) for the MSP430G2553, runs it
+# under mspdebug's instruction-set simulator with timer A1 modelled, and prints the SMCLK
+# cycles main() spent on each case. Exits non-zero if any case needs more than the budget.
+#
+#  bench/run.sh [budget]        # default 2048 cycles, a quarter of the 8192 between ticks
+#
+# CC, CFLAGS and MSPDEBUG may be overridden, e.g. to add the include path of the device
+# headers: CFLAGS="-I/opt/msp430-gcc/include -L/opt/msp430-gcc/include" bench/run.sh
+# Build options go in CFLAGS as for the firmware (-DCOLLECTIVE_CONTROL=0, ...).
+
+set -e
+
+BUDGET=${1:-2048}
+CC=${CC:-msp430-elf-gcc}
+MSPDEBUG=${MSPDEBUG:-mspdebug}
+OUT=${OUT:-${TMPDIR:-/tmp}/elevator-bench}
+
+# one name per entry of bench_cycles[], in the order bench_run() fills it
+CASES="tick_i_homing tick_c_calibrate tick_x_idle tick_x_leave tick_up_hall tick_dn_hall
+tick_u_rider tick_d_rider tick_w_dwell tick_w_leave limit_pass limit_stop tower_wake
+elev_select limit_elev tick_all_held"
+NUM_CASES=$(echo $CASES | wc -w)
+
+cd "$(dirname "$0")/.."
+mkdir -p "$OUT"
+
+$CC -mmcu=msp430g2553 -Os $CFLAGS -o "$OUT/bench.elf" bench/bench.c
+
+# timer A1 sits at 0x0180 on this device; the simulator clocks it with every cycle
+$MSPDEBUG -n sim \
+    "prog $OUT/bench.elf" \
+    "simio add timer ta1" \
+    "simio config ta1 base 0x0180" \
+    "setbreak bench_done" \
+    "run" \
+    "md bench_cycles $((NUM_CASES * 2))" > "$OUT/mspdebug.log"
+
+# md prints "address: byte byte ... |ascii|", the counts are little-endian 16-bit words
+awk -v budget="$BUDGET" -v names="$CASES" '
+    /^ *(0x)?[0-9a-fA-F]+:/ {
+        sub(/^[^:]*:/, "")
+        for (i = 1; i <= NF && $i ~ /^[0-9a-fA-F][0-9a-fA-F]$/; i++) {
+            bytes[n++] = $i
+        }
+    }
+    function hex(s) {
+        return index("0123456789abcdef", tolower(substr(s, 1, 1))) * 16 - 16 + \
+               index("0123456789abcdef", tolower(substr(s, 2, 1))) - 1
+    }
+    END {
+        count = split(names, name, " ")
+        if (n < 2 * count) {
+            print "bench: no results in the simulator output" > "/dev/stderr"
+            exit 2
+        }
+        printf "%-16s %7s %7s\n", "case", "cycles", "budget"
+        for (i = 0; i < count; i++) {
+            cycles = hex(bytes[2 * i]) + 256 * hex(bytes[2 * i + 1])
+            over = (cycles > budget)
+            failed += over
+            printf "%-16s %7d %7d%s\n", name[i + 1], cycles, budget, over ? "  OVER" : ""
+        }
+        exit failed ? 1 : 0
+    }' "$OUT/mspdebug.log"
@@ -0,0 +1,265 @@
+#ifndef ELEVATOR_H
+#define ELEVATOR_H
+
+/*
+ * Elevator Control System - board wiring and shared state
+ * Copyright 2015 Carlton Duffett and Neeraj Basu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Shared by the firmware (main.c) and the host simulator (host/sim.c) so both agree
+ * on which pin carries which signal.
+ */
+
+// port 1 bit mask
+#define SEVENSEG_A0     0x01    // seven segment display addresses
+#define SEVENSEG_A1     0x02
+#define PWM             0x04    // pulse-width modulation for motor control
+#define SEVENSEG_A2     0x08
+#define TOWER_EN        0x10    // on-tower call buttons, enable
+#define TOWER_A0        0x20    // on-tower call buttons, addresses
+#define TOWER_A1        0x40
+#define TOWER_A2        0x80
+
+// port 2 bit mask
+#define LIMIT_EN        0x01    // limit switches, enable
+#define LIMIT_A0        0x02    // limit switches, addresses
+#define LIMIT_A1        0x04
+#define ELEV_EN         0x08    // in-elevator buttons, enable
+#define ELEV_A0         0x10    // in-elevator buttons, addresses
+#define ELEV_A1         0x20
+#define UPCTL           0x40    // up direction selection for motor control
+#define DNCTL           0x80    // down direction selection for motor control
+
+// number of floors served, a build parameter (e.g. -DNUM_FLOORS=3)
+#ifndef NUM_FLOORS
+#define NUM_FLOORS      4
+#endif
+
+#if NUM_FLOORS < 2 || NUM_FLOORS > 64
+#error "NUM_FLOORS must be between 2 and 64"
+#endif
+
+// shaft segments between adjacent floors, segment n runs from floor n + 1 to floor n + 2
+#define FLOOR_SEGMENTS      (NUM_FLOORS - 1)
+
+// encoder address widths needed for NUM_FLOORS
+// tower buttons: up on every floor but the top, down on every floor but the first
+#define ADDR_BITS(n)        ((n) <= 2 ? 1 : (n) <= 4 ? 2 : (n) <= 8 ? 3 : (n) <= 16 ? 4 : \
+                             (n) <= 32 ? 5 : (n) <= 64 ? 6 : 7)
+#define TOWER_BUTTONS       (2 * NUM_FLOORS - 2)
+#define TOWER_ADDR_BITS     ADDR_BITS(TOWER_BUTTONS)
+#define FLOOR_ADDR_BITS     ADDR_BITS(NUM_FLOORS)
+
+// a sample of an input port: a byte on the board, wider in the host register file so the
+// simulator can run shafts taller than the board has address lines for
+#ifdef HAL_HOST
+typedef unsigned long port_sample_t;
+#else
+typedef unsigned char port_sample_t;
+#endif
+
+// address fields, the LSB of each field sits on the *_A0 pin
+#if defined(HAL_HOST) && NUM_FLOORS > 4
+// host builds for a taller shaft move the fields above the board's eight pins
+#define TOWER_ADDR_SHIFT    8
+#define ELEV_ADDR_SHIFT     16
+#define LIMIT_ADDR_SHIFT    8
+#else
+#define TOWER_ADDR_SHIFT    5
+#define ELEV_ADDR_SHIFT     4
+#define LIMIT_ADDR_SHIFT    1
+#endif
+#define TOWER_ADDR_MASK     (((1 << TOWER_ADDR_BITS) - 1) << TOWER_ADDR_SHIFT)
+#define ELEV_ADDR_MASK      (((1 << FLOOR_ADDR_BITS) - 1) << ELEV_ADDR_SHIFT)
+#define LIMIT_ADDR_MASK     (((1 << FLOOR_ADDR_BITS) - 1) << LIMIT_ADDR_SHIFT)
+
+// a taller shaft needs wider encoders than this board has address lines for
+#ifndef HAL_HOST
+#if (TOWER_ADDR_MASK & ~0xFF) || (TOWER_ADDR_MASK & (TOWER_EN | PWM | SEVENSEG_A2))
+#error "NUM_FLOORS needs more tower button address lines than port 1 provides"
+#endif
+#if (ELEV_ADDR_MASK & (UPCTL | DNCTL)) || (LIMIT_ADDR_MASK & ELEV_EN)
+#error "NUM_FLOORS needs more floor address lines than port 2 provides"
+#endif
+#endif // HAL_HOST
+
+// on-tower buttons are numbered down from the highest-priority encoder input:
+// F1_UP, F2_DN, F2_UP, F3_DN, F3_UP, ... FN_DN
+#define TOWER_TOP_ADDR              ((1 << TOWER_ADDR_BITS) - 1)
+#define TOWER_ADDR(floor, up)       (TOWER_TOP_ADDR - 2 * ((floor) - 1) + !(up))
+#define TOWER_ADDR_FLOOR(addr)      ((TOWER_TOP_ADDR - (addr) + 1) / 2 + 1)
+#define TOWER_ADDR_DOWN(addr)       ((TOWER_TOP_ADDR - (addr)) & 1)
+#define TOWER_ADDR_USED(addr)       (TOWER_TOP_ADDR - (addr) < TOWER_BUTTONS)
+
+// input mode: edges on the encoder EN lines raise port interrupts, so the first press is
+// handled at once, and the WDT polls an encoder only while its EN line is held
+// (set to 0 to poll every encoder on every WDT tick)
+#ifndef INPUT_IRQ
+#define INPUT_IRQ       1
+#endif
+
+// deep idle: parked in 'x' with nothing pending, the controller stops the WDT and the PWM
+// timer and sleeps in LPM3 until a button edge wakes it (needs INPUT_IRQ)
+#ifndef DEEP_IDLE
+#define DEEP_IDLE       INPUT_IRQ
+#endif
+
+#if DEEP_IDLE && !INPUT_IRQ
+#error "DEEP_IDLE needs INPUT_IRQ to wake on a button press"
+#endif
+
+// status display: while the car is moving or waiting for a destination, the display
+// alternates the floor with a status glyph on a spare 74LS247 code (needs floors 1 - 4
+// to leave codes 5 - 7 spare)
+#ifndef DISPLAY_STATUS
+#define DISPLAY_STATUS  (NUM_FLOORS <= 4)
+#endif
+
+#if DISPLAY_STATUS && NUM_FLOORS > 4
+#error "DISPLAY_STATUS needs the display codes above NUM_FLOORS"
+#endif
+
+// boot calibration: with no valid table in information memory, or an in-car button held
+// through reset, time the shaft once after homing and store the table for later boots
+#ifndef BOOT_CALIBRATION
+#define BOOT_CALIBRATION    1
+#endif
+
+// warm restart: keep the floor and pending calls in RAM the startup code leaves alone, and
+// after a reset resume service at once if the closed limit switch confirms that floor
+#ifndef WARM_RESTART
+#define WARM_RESTART        1
+#endif
+
+// profiling: time every interrupt handler, and the work main() does for each event, on
+// the free-running timer A1 and keep per-path statistics in RAM for a debugger to read
+// out (see host/profile_dump.c)
+#ifndef PROFILE_EVENTS
+#define PROFILE_EVENTS      0
+#endif
+
+// state trace: a ring of the last TRACE_RECORDS state changes, each with the tick and the
+// input that caused it, in RAM that survives a reset, for a debugger to read out (see
+// host/trace_dump.c)
+// of the 512 B of RAM the default build's globals take about 290 B, 68 B of them the
+// trace; the 140 B profile table would leave under 90 B of stack for main() and a nested
+// handler, so a profiling build leaves the trace out
+#ifndef STATE_TRACE
+#define STATE_TRACE         (!PROFILE_EVENTS)
+#endif
+
+#if PROFILE_EVENTS && STATE_TRACE && !defined(HAL_HOST)
+#error "PROFILE_EVENTS and STATE_TRACE together leave too little RAM for the stack"
+#endif
+
+// state variables (defined in main.c)
+extern volatile unsigned char state;
+extern volatile unsigned char current_floor;
+extern volatile unsigned int dwell;
+
+// debounced inputs, one per encoder (defined in main.c)
+#define IN_TOWER        0
+#define IN_ELEV         1
+#define IN_LIMIT        2
+#define INPUTS          3
+
+extern volatile unsigned char input_code[INPUTS];
+extern volatile unsigned int input_held[INPUTS];
+extern volatile unsigned int input_presses[INPUTS];
+extern volatile unsigned int input_releases[INPUTS];
+
+#if DEEP_IDLE
+// time from the waking button edge to the motor outputs being written, in SMCLK cycles (us)
+// (not modelled by the host simulator, where TA1R stands still within a call)
+extern volatile unsigned int wake_latency, wake_latency_max;
+#endif
+
+// motion profile settings, from the boot calibration or the defaults (defined in main.c)
+extern unsigned int motor_deadband[2];
+extern unsigned long target_work[2][FLOOR_SEGMENTS];
+
+#if WARM_RESTART
+// saved after every pass of the main loop (defined in main.c)
+void save_warm_state(void);
+#endif
+
+// interrupt handler bookkeeping (defined in main.c)
+extern volatile unsigned int events_dropped;
+extern volatile unsigned int isr_time_max;
+
+#if STATE_TRACE
+#define TRACE_RECORDS       16  // power of two
+#define TRACE_MASK          (TRACE_RECORDS - 1)
+
+// input fields of a record: what was handled when the state changed
+#define TRACE_TICK          0x00    // a WDT tick's own work, with the floor the car was at
+#define TRACE_TOWER         0x40    // a press, polled by a tick or from an input event, or
+#define TRACE_ELEV          0x80    // an input event, with the encoder's code (address + 1,
+                                    // 0 once released)
+#define TRACE_LIMIT         0xC0
+#define TRACE_SOURCE        0xC0
+
+// one state change in four bytes, states as their low nibble, which differs for every
+// state ('i' 9, 'c' 3, 'x' 8, '^' E, 'u' 5, 'v' 6, 'd' 4, 'w' 7); a reset is logged as a
+// change from 0 to the state the controller starts in
+struct trace_record {
+    unsigned int tick;          // WDT ticks since the reset, wraps after ~9 min
+    unsigned char states;       // old state << 4 | new state
+    unsigned char input;        // TRACE_ source | code or floor
+};
+
+struct state_trace {
+    unsigned int magic;
+    unsigned int head;          // records written (folded once full), the next goes to
+                                // head & TRACE_MASK
+    struct trace_record record[TRACE_RECORDS];
+};
+
+extern struct state_trace trace;
+#endif
+
+#if PROFILE_EVENTS
+// profiled paths: the three handlers, a tick in each state (in PATH_STATES order), and an
+// input event by encoder
+#define PATH_WDT_IRQ        0
+#define PATH_PORT1_IRQ      1
+#define PATH_PORT2_IRQ      2
+#define PATH_TICK           3
+#define PATH_STATES         "icx^uvdw"
+#define PATH_TOWER          11
+#define PATH_ELEV           12
+#define PATH_LIMIT          13
+#define PATHS               14
+
+// run time of one path in SMCLK cycles (10 bytes on the device, no padding)
+struct path_profile {
+    unsigned int count;     // runs seen, stops at 0xFFFF
+    unsigned int min;
+    unsigned int max;
+    unsigned long sum;      // of the first count runs
+};
+
+extern struct path_profile profile[PATHS];
+#endif
+
+// entry points used by the host simulator
+void init_system(void);
+void main_loop(void);
+interrupt void WDT_interval_handler();
+#if INPUT_IRQ
+interrupt void PORT1_handler();
+interrupt void PORT2_handler();
+#endif
+
+#endif // ELEVATOR_H
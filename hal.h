@@ -0,0 +1,60 @@
+#ifndef HAL_H
+#define HAL_H
+
+/*
+ * Elevator Control System - hardware abstraction
+ * Copyright 2015 Carlton Duffett and Neeraj Basu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * The control logic in main.c only ever touches the MSP430 through the register
+ * names defined by the device header (P1IN, P2OUT, TA0CCR1, ...). This header picks
+ * where those names come from:
+ *
+ * MSP430   the real device header, so every access is the same register access as before
+ * host     host/msp430_host.h, a simulated register file with identical names
+ *
+ * No wrapper functions are involved, so the firmware build is unchanged.
+ *
+ * NOINIT(var), placed before a declaration, keeps a variable out of the C startup code's
+ * initialization so it survives a reset.
+ */
+
+#if defined(__MSP430__)
+
+#include <msp430g2553.h>
+
+#if defined(__TI_COMPILER_VERSION__)
+#define HAL_PRAGMA(x)   _Pragma(#x)
+#define NOINIT(var)     HAL_PRAGMA(NOINIT(var))
+#elif defined(BENCH)
+#define NOINIT(var)     __attribute__((section(".noinit")))
+
+// GCC (msp430-elf-gcc) is only used for the benchmark (bench/), which calls the handlers'
+// code directly, so the handlers are compiled as such but not placed in the vector table
+#define interrupt       __attribute__((interrupt))
+#define ISR_VECTOR(func, section)
+#else
+#error "the firmware is built with the TI compiler, msp430-elf-gcc only builds bench/"
+#endif
+
+#else
+
+#define HAL_HOST    1   // building the control logic natively, e.g. for the simulator
+#include "host/msp430_host.h"
+
+#define NOINIT(var)     // the host never resets, the simulator fills these in directly
+
+#endif
+
+#endif // HAL_H
@@ -0,0 +1,69 @@
+#ifndef MD_DUMP_H
+#define MD_DUMP_H
+
+/*
+ * Reader for hex dumps in the format of mspdebug's md command
+ * Copyright 2015 Carlton Duffett and Neeraj Basu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Shared by the host tools that decode a variable read off the board (profile_dump.c,
+ * trace_dump.c). Every line is read as "address: byte byte ... |ascii|", the address is
+ * ignored and the bytes are taken in order, so any dump with that layout works.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+// read the dump on stdin into buf, up to size bytes, returns the number of bytes found
+static int read_md_dump(unsigned char *buf, int size) {
+
+    char line[256];
+    int n = 0;
+
+    while (n < size && fgets(line, sizeof(line), stdin)) {
+
+        char *p = strchr(line, ':');
+
+        if (!p) {
+            continue; // not a dump line
+        }
+        p++;
+
+        // bytes are two hex digits apart from everything else, the ASCII column is not
+        while (n < size) {
+
+            unsigned int byte;
+
+            while (*p == ' ' || *p == '\t') {
+                p++;
+            }
+            if (!isxdigit((unsigned char)p[0]) || !isxdigit((unsigned char)p[1]) ||
+                isxdigit((unsigned char)p[2]) || sscanf(p, "%2x", &byte) != 1) {
+                break;
+            }
+            buf[n++] = (unsigned char)byte;
+            p += 2;
+        }
+    }
+    return n;
+}
+
+// little-endian words as the MSP430 stores them
+static unsigned int word_at(const unsigned char *p) {
+
+    return p[0] | (p[1] << 8);
+}
+
+#endif // MD_DUMP_H
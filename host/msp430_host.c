@@ -0,0 +1,45 @@
+/*
+ * Simulated MSP430G2553 register file for host builds
+ * Copyright 2015 Carlton Duffett and Neeraj Basu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "msp430_host.h"
+
+// digital I/O
+volatile unsigned long P1IN, P2IN;
+volatile unsigned char P1OUT, P1DIR, P1SEL, P1IE, P1IES, P1IFG;
+volatile unsigned char P2OUT, P2DIR, P2SEL, P2IE, P2IES, P2IFG;
+
+// basic clock system, calibration constants as programmed at the factory
+volatile unsigned char BCSCTL1, BCSCTL3, DCOCTL;
+volatile unsigned char CALBC1_1MHZ = 0x86;
+volatile unsigned char CALDCO_1MHZ = 0xC0;
+
+// timer A0
+volatile unsigned short TA0CTL, TA0CCTL1, TA0CCR0, TA0CCR1;
+
+// timer A1
+volatile unsigned short TA1CTL, TA1R;
+
+// flash controller, and segment D as plain memory: the firmware always erases before it
+// programs, so writes can simply overwrite (the simulator erases it to 0xFF at start)
+volatile unsigned short FCTL1, FCTL2, FCTL3;
+unsigned int host_info_d[512];
+
+// watchdog timer (the device powers up with the watchdog running) and SFRs
+volatile unsigned short WDTCTL = 0x6900;
+volatile unsigned char IE1;
+
+volatile unsigned short host_SR;
@@ -0,0 +1,115 @@
+#ifndef MSP430_HOST_H
+#define MSP430_HOST_H
+
+/*
+ * Simulated MSP430G2553 register file for host builds
+ * Copyright 2015 Carlton Duffett and Neeraj Basu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Only the registers and bit names used by main.c are provided. Registers are plain
+ * volatile globals (storage in msp430_host.c) with the same widths as on the device,
+ * except P1IN and P2IN, which are wider (see below), so the firmware compiles unmodified
+ * and the host side can read outputs and drive inputs directly. Nothing here models peripheral behaviour; that is left to the
+ * simulator driving the firmware.
+ */
+
+// ================ REGISTERS ================
+
+// digital I/O
+// the inputs are wider than the device's, room for the address fields of a taller shaft
+// (see port_sample_t in elevator.h)
+extern volatile unsigned long P1IN, P2IN;
+extern volatile unsigned char P1OUT, P1DIR, P1SEL, P1IE, P1IES, P1IFG;
+extern volatile unsigned char P2OUT, P2DIR, P2SEL, P2IE, P2IES, P2IFG;
+
+// basic clock system
+extern volatile unsigned char BCSCTL1, BCSCTL3, DCOCTL;
+extern volatile unsigned char CALBC1_1MHZ, CALDCO_1MHZ;
+
+// timer A0
+extern volatile unsigned short TA0CTL, TA0CCTL1, TA0CCR0, TA0CCR1;
+
+// timer A1
+extern volatile unsigned short TA1CTL, TA1R;
+
+// flash controller, and information memory segment D (sized for host int widths)
+extern volatile unsigned short FCTL1, FCTL2, FCTL3;
+// segment D, with room for the calibration table of a 64-floor host build
+extern unsigned int host_info_d[512];
+#define INFOD_START host_info_d
+
+// watchdog timer and special function registers
+extern volatile unsigned short WDTCTL;
+extern volatile unsigned char IE1;
+
+// status register, only the low-power and interrupt enable bits are meaningful
+extern volatile unsigned short host_SR;
+
+// ================ BIT DEFINITIONS ================
+
+// status register
+#define GIE         0x0008
+#define CPUOFF      0x0010
+#define SCG0        0x0040
+#define SCG1        0x0080
+#define LPM0_bits   (CPUOFF)
+#define LPM3_bits   (SCG1 + SCG0 + CPUOFF)
+
+// basic clock system control 3
+#define LFXT1S_2    0x20    // ACLK from VLO
+
+// timer A control
+#define TASSEL_2    0x0200  // SMCLK
+#define ID_0        0x0000
+#define MC_1        0x0010  // up mode
+#define MC_2        0x0020  // continuous mode
+#define TACLR       0x0004
+
+// timer A capture/compare control
+#define OUTMOD_0    0x0000  // output bit
+#define OUTMOD_7    0x00E0  // reset/set
+#define OUT         0x0004
+
+// watchdog timer
+#define WDTPW       0x5A00
+#define WDTHOLD     0x0080
+#define WDTTMSEL    0x0010
+#define WDTCNTCL    0x0008
+
+// flash controller
+#define FWKEY       0xA500
+#define ERASE       0x0002
+#define WRT         0x0040
+#define LOCK        0x0010
+#define FSSEL_1     0x0040  // MCLK
+#define FN1         0x0002
+
+// interrupt enable 1
+#define WDTIE       0x01
+
+// ================ COMPILER INTRINSICS ================
+
+#define interrupt
+#define ISR_VECTOR(func, section)
+
+// nothing blocks on the host: entering a low-power mode only sets the bits, and the
+// simulator stops running main() until an interrupt handler clears them again
+#define _bis_SR_register(bits)  (host_SR |= (bits))
+#define _disable_interrupts()   (host_SR &= ~GIE)
+#define _enable_interrupts()    (host_SR |= GIE)
+
+// the host has no saved SR, so the bits take effect on the live one
+#define _bic_SR_register_on_exit(bits)  (host_SR &= ~(bits))
+
+#endif // MSP430_HOST_H
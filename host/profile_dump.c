@@ -0,0 +1,89 @@
+/*
+ * Elevator Control System - event profile report
+ * Copyright 2015 Carlton Duffett and Neeraj Basu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Turns the profile table of a firmware built with -DPROFILE_EVENTS=1 into a report of
+ * SMCLK cycles per path and the share of the 8192-cycle WDT interval each one uses.
+ *
+ * The table is read from the running board with the debugger, as a hex dump of
+ * sizeof(profile) bytes in the format of mspdebug's md command:
+ *
+ *  mspdebug rf2500 "sym import elevator.elf" "md profile 140" | ./profile_dump
+ *
+ * The dump is parsed by host/md_dump.h. Build on the host with:
+ *
+ *  cc -O2 -o profile_dump host/profile_dump.c
+ */
+
+#include <stdio.h>
+
+#define PROFILE_EVENTS  1
+
+#include "../hal.h"
+#include "../elevator.h"
+#include "md_dump.h"
+
+// layout of struct path_profile on the device: three 16-bit words and a 32-bit sum,
+// little endian with no padding
+#define RECORD_BYTES    10
+#define TABLE_BYTES     (PATHS * RECORD_BYTES)
+
+// SMCLK cycles between WDT ticks
+#define TICK_CYCLES     8192
+
+static const char *const path_names[PATHS] = {
+    "WDT interrupt", "PORT1 interrupt", "PORT2 interrupt",
+    "tick in 'i'", "tick in 'c'", "tick in 'x'", "tick in '^'",
+    "tick in 'u'", "tick in 'v'", "tick in 'd'", "tick in 'w'",
+    "tower button", "car button", "limit switch",
+};
+
+typedef char path_names_complete[sizeof(PATH_STATES) - 1 == PATH_TOWER - PATH_TICK ? 1 : -1];
+
+static unsigned char table[TABLE_BYTES];
+
+static unsigned long long_at(const unsigned char *p) {
+
+    return word_at(p) | ((unsigned long)word_at(p + 2) << 16);
+}
+
+int main(void) {
+
+    int n = read_md_dump(table, TABLE_BYTES), i;
+
+    if (n < TABLE_BYTES) {
+        fprintf(stderr, "profile_dump: read %d of %d bytes, dump the whole profile table\n",
+                n, TABLE_BYTES);
+        return 1;
+    }
+
+    printf("%-16s %7s %7s %7s %9s %7s\n", "path", "runs", "min", "mean", "max", "of tick");
+
+    for (i = 0; i < PATHS; i++) {
+
+        const unsigned char *r = &table[i * RECORD_BYTES];
+        unsigned int count = word_at(r), min = word_at(r + 2), max = word_at(r + 4);
+        unsigned long sum = long_at(r + 6);
+
+        if (!count) {
+            printf("%-16s %7s\n", path_names[i], "-");
+            continue;
+        }
+        printf("%-16s %6u%s %7u %7lu %9u %6.1f%%\n", path_names[i], count,
+               (count == 0xFFFF) ? "+" : " ", min, sum / count, max,
+               100.0 * max / TICK_CYCLES);
+    }
+    return 0;
+}
@@ -0,0 +1,850 @@
+/*
+ * Elevator Control System - discrete-event building simulator
+ * Copyright 2015 Carlton Duffett and Neeraj Basu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Runs the unmodified control logic from main.c against a model of the tower:
+ *
+ * 1. the car, driven by the H-bridge direction lines and the Timer A PWM duty
+ * 2. the limit switches, closed while the car is within SWITCH_BAND of a floor
+ * 3. the three 74LS148 encoders, fed by the buttons passengers are holding, with
+ *    contact bounce at make and break of every button and limit switch
+ * 4. the WDT interval tick (SMCLK / 8192) that calls WDT_interval_handler
+ * 5. the P1/P2 edge detectors, which latch PxIFG and call the port handlers when the
+ *    firmware is built with INPUT_IRQ
+ * 6. the low-power modes: in LPM3 SMCLK stops, and with it the WDT and timer A1
+ * 7. main(), run after every interrupt until it goes back to sleep
+ * 8. information memory, erased at the start of every run, so the firmware runs its boot
+ *    calibration (if built with it) before serving anyone
+ *
+ * Time advances in SUBSTEPS slices per WDT tick while anything can change, so input
+ * edges reach the port handlers between ticks as they would on the board. When the car
+ * is parked in state 'x' and no button is held, the simulator jumps straight to
+ * the next passenger event, so idle stretches cost nothing.
+ *
+ * Build and run on the host:
+ *
+ *  cc -O2 -o elevsim main.c host/msp430_host.c host/sim.c -lm
+ *  ./elevsim -r 60 -H 24
+ *
+ * Passengers arrive as a Poisson process with uniformly chosen origin and destination.
+ * Each one presses the hall button, boards when the car is stopped at their floor,
+ * presses their destination and leaves when the car stops there. Because the firmware
+ * may ignore a press, passengers press again every REPRESS_S seconds, and give up on
+ * the car after GIVE_UP_S seconds of standing still at the wrong floor.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../hal.h"
+#include "../elevator.h"
+
+// ================ MODEL PARAMETERS ================
+
+#define TICK_S          (8192.0 / 1000000.0)    // WDT interval, SMCLK / 8192
+#define SUBSTEPS        8                       // input and physics slices per tick
+
+// car dynamics, distances in floors and times in seconds
+#define SWITCH_BAND     0.04    // limit switch is closed within this distance of a floor
+#define SHAFT_MARGIN    0.05    // structural travel past the first and last floor
+#define MOTOR_GAIN      1.0     // cruise speed per unit duty above the dead band
+#define MOTOR_DEADBAND  0.10    // duty the gearbox needs before the car moves at all
+#define GRAVITY_ASSIST  0.05    // extra speed when driving down
+#define LOAD_PER_RIDER  0.02    // speed lost going up (gained going down) per rider
+#define TAU_DRIVE       0.15    // time constant of the car under power
+#define TAU_BRAKE       0.06    // time constant with both H-bridge inputs high
+#define TAU_COAST       0.15    // time constant with the bridge disabled
+#define REST_SPEED      0.001   // below this the car is considered stopped
+#define SWITCH_CHATTER  0.002   // limit switch contact is uncertain this close to the band edge
+
+// contacts read at random for this long after a button is pressed and after it is released
+#define BOUNCE_S        0.005
+
+// a car that takes longer than this to start for a call is noticeably slow
+#define START_VISIBLE_S 0.1
+
+// passenger behaviour
+#define PRESS_S         0.15    // how long a button is held
+#define REPRESS_S       5.0     // interval between presses of an unanswered button
+#define GIVE_UP_S       30.0    // rider leaves a car parked at the wrong floor
+#define ABANDON_S       600.0   // waiting passenger leaves the building
+#define CAR_CAPACITY    6
+
+// ================ PASSENGERS ================
+
+enum { WAITING, RIDING, DELIVERED, ABANDONED };
+
+struct passenger {
+    int status;
+    int origin;             // floor the passenger is currently waiting at (1 - NUM_FLOORS)
+    int dest;
+    double t_arrive;        // arrival in the lobby of the original floor
+    double t_board;         // most recent boarding
+    double t_exit;
+    double press_until;     // button held until this time
+    int press_tower;        // the button is a hall button (else a car button)
+    int press_addr;         // encoder address of the button
+    double next_press;      // next time an unanswered button is pressed again
+};
+
+static struct passenger *pax;
+static int num_pax, cap_pax;
+static int *active;         // indices of passengers still waiting or riding
+static int num_active;
+
+// ================ SIMULATION STATE ================
+
+static double now;              // simulated time
+static unsigned long tick;      // WDT ticks elapsed
+static unsigned long isr_calls; // WDT_interval_handler invocations actually executed
+static unsigned long port_calls;  // PORT1/PORT2 handler invocations
+static double lpm3_s;           // time spent with SMCLK stopped
+static double smclk_us;         // SMCLK cycles while timer A1 runs, drives TA1R
+
+// starts from idle: first button edge with the car parked to the motor being driven
+static double start_press = -1.0;
+static unsigned char start_state;
+static unsigned long starts, slow_starts;
+static double sum_start_s, max_start_s;
+
+static double motor_gain = MOTOR_GAIN; // -m, e.g. 0.8 for a weak battery
+static double in_service_s = -1.0;      // first time the car was ready for calls
+static double car_pos;          // 0 = floor 1, 1 = floor 2, ...
+static double car_vel;
+static double car_rest_since;   // time at which the car last came to rest
+static int car_riders;
+static int car_resting;
+
+// travel: time spent moving and distance covered, for the mean time per floor, overall
+// and by load (empty car, and half full or more)
+static double travel_s, travel_floors, peak_speed;
+static double load_travel_s[2], load_travel_floors[2];
+
+// leveling: distance from the floor centre each time the car settles at a switch, and
+// the speed at which it reached that switch
+static unsigned long stops;
+static double sum_stop_err, max_stop_err;
+static double sum_landing, max_landing, switch_speed;
+static int switch_was_closed;
+
+static unsigned long long rng_state = 0x9E3779B97F4A7C15ULL;
+static unsigned long long bounce_state = 0xD1B54A32D192ED03ULL;
+
+// physical presses (and limit switch closures) for comparison with the firmware's count
+static unsigned long presses[INPUTS];
+
+static double rng_uniform(void) {
+
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double rng_exponential(double mean) {
+
+    return -mean * log(1.0 - rng_uniform());
+}
+
+// contact bounce draws from its own generator so it leaves the passenger stream alone
+static int bounce_bit(void) {
+
+    bounce_state ^= bounce_state >> 12;
+    bounce_state ^= bounce_state << 25;
+    bounce_state ^= bounce_state >> 27;
+    return (int)((bounce_state * 2685821657736338717ULL) >> 63);
+}
+
+// ================ TOWER MODEL ================
+
+// floor whose limit switch is closed, or 0
+static int closed_switch(void) {
+
+    int f = (int)floor(car_pos + 0.5);
+
+    if (f >= 0 && f < NUM_FLOORS && fabs(car_pos - f) <= SWITCH_BAND) {
+        return f + 1;
+    }
+    return 0;
+}
+
+// motor drive as seen by the car: +1 up, -1 down, 0 brake, 2 coast
+static int motor_mode(void) {
+
+    unsigned char dir = P2OUT & (UPCTL + DNCTL);
+
+    if (dir == UPCTL) {
+        return 1;
+    }
+    if (dir == DNCTL) {
+        return -1;
+    }
+    return (dir ? 0 : 2);
+}
+
+static double pwm_duty(void) {
+
+    if (!(P1SEL & PWM)) {
+        return 0.0;
+    }
+    // in output mode 0 the pin is the OUT bit, a stopped timer holds it where it was
+    if ((TA0CCTL1 & OUTMOD_7) == OUTMOD_0) {
+        return (TA0CCTL1 & OUT) ? 1.0 : 0.0;
+    }
+    if (!(TA0CTL & MC_1)) {
+        return 0.0;
+    }
+    return (double)TA0CCR1 / (TA0CCR0 + 1);
+}
+
+static int car_at_rest(void) {
+
+    int mode = motor_mode();
+    return (mode == 0 || mode == 2) && fabs(car_vel) < REST_SPEED;
+}
+
+// advance the car by dt under the current outputs, using the exact first-order response
+static void move_car(double dt) {
+
+    int mode = motor_mode();
+    double target = 0.0, tau = TAU_COAST, e, top = NUM_FLOORS - 1;
+
+    if (mode == 1 || mode == -1) {
+
+        double drive = motor_gain * (pwm_duty() - MOTOR_DEADBAND);
+
+        if (drive < 0.0) {
+            drive = 0.0; // the gearbox is not back-drivable, so the car just holds
+        }
+        else if (mode == 1) {
+            target = drive - LOAD_PER_RIDER * car_riders;
+            if (target < 0.0) {
+                target = 0.0;
+            }
+        }
+        else {
+            target = -(drive + GRAVITY_ASSIST + LOAD_PER_RIDER * car_riders);
+        }
+        tau = TAU_DRIVE;
+    }
+    else if (mode == 0) {
+        tau = TAU_BRAKE;
+    }
+
+    e = exp(-dt / tau);
+    car_pos += target * dt + (car_vel - target) * tau * (1.0 - e);
+    car_vel = target + (car_vel - target) * e;
+
+    if (car_pos < -SHAFT_MARGIN) {
+        car_pos = -SHAFT_MARGIN;
+        car_vel = 0.0;
+    }
+    else if (car_pos > top + SHAFT_MARGIN) {
+        car_pos = top + SHAFT_MARGIN;
+        car_vel = 0.0;
+    }
+
+    if (target == 0.0 && fabs(car_vel) < REST_SPEED * 0.01) {
+        car_vel = 0.0;
+    }
+}
+
+// limit switch contact as the encoder sees it, chattering near the edge of the band
+static int switch_contact(void) {
+
+    int f = (int)floor(car_pos + 0.5);
+    double d = fabs(car_pos - f);
+
+    if (f < 0 || f >= NUM_FLOORS || d >= SWITCH_BAND + SWITCH_CHATTER) {
+        return 0;
+    }
+    if (d > SWITCH_BAND - SWITCH_CHATTER && !bounce_bit()) {
+        return 0;
+    }
+    return f + 1;
+}
+
+// whether a passenger's button contact is closed, bouncing at make and break
+static int button_contact(const struct passenger *p) {
+
+    double start = p->press_until - PRESS_S;
+
+    if (now >= p->press_until + BOUNCE_S) {
+        return 0;
+    }
+    if (now < start + BOUNCE_S || now >= p->press_until) {
+        return bounce_bit();
+    }
+    return 1;
+}
+
+// drive P1IN/P2IN from the limit switches and every button currently held
+static void sample_inputs(void) {
+
+    static int last_limit;
+    port_sample_t p1 = 0, p2 = 0;
+    int tower = -1, elev = -1, limit = switch_contact(), i;
+
+    if (closed_switch() && !last_limit) {
+        presses[IN_LIMIT]++;
+    }
+    last_limit = closed_switch();
+
+    // each 74LS148 reports only its highest-priority active input
+    for (i = 0; i < num_active; i++) {
+
+        struct passenger *p = &pax[active[i]];
+
+        if (!button_contact(p)) {
+            continue;
+        }
+        if (p->press_tower) {
+            if (p->press_addr > tower) {
+                tower = p->press_addr;
+            }
+        }
+        else if (p->press_addr > elev) {
+            elev = p->press_addr;
+        }
+    }
+
+    if (tower >= 0) {
+        p1 |= TOWER_EN | (tower << TOWER_ADDR_SHIFT);
+    }
+    if (limit) {
+        p2 |= LIMIT_EN | ((limit - 1) << LIMIT_ADDR_SHIFT);
+    }
+    if (elev >= 0) {
+        p2 |= ELEV_EN | (elev << ELEV_ADDR_SHIFT);
+    }
+
+    P1IN = p1;
+    P2IN = p2;
+}
+
+// SMCLK, and everything clocked from it, stops in LPM3
+static int smclk_running(void) {
+
+    return !(host_SR & SCG1);
+}
+
+static int wdt_running(void) {
+
+    return smclk_running() && !(WDTCTL & WDTHOLD);
+}
+
+// run the firmware main loop until it puts the CPU to sleep again
+static void run_main(void) {
+
+    while (!(host_SR & CPUOFF)) {
+        main_loop();
+    }
+}
+
+// time a start from idle once the motor is driven; a press the firmware has not acted on
+// by the end of the next WDT tick did not call for a start
+static void check_start(int after_tick) {
+
+    int mode = motor_mode();
+
+    if (start_press < 0.0) {
+        return;
+    }
+    if (mode == 1 || mode == -1) {
+
+        double t = now - start_press;
+
+        starts++;
+        sum_start_s += t;
+        if (t > max_start_s) {
+            max_start_s = t;
+        }
+        if (t > START_VISIBLE_S) {
+            slow_starts++;
+        }
+        start_press = -1.0;
+    }
+    else if (after_tick || state != start_state) {
+        start_press = -1.0;
+    }
+}
+
+// present the inputs at the current time, latch edges and run any port handler they raise
+static void drive_inputs(void) {
+
+    port_sample_t p1 = P1IN, p2 = P2IN;
+
+    sample_inputs();
+
+    if ((state == 'x' || state == 'w') && !dwell && start_press < 0.0 &&
+        ((!(p1 & TOWER_EN) && (P1IN & TOWER_EN)) || (!(p2 & ELEV_EN) && (P2IN & ELEV_EN)))) {
+        start_press = now;
+        start_state = state;
+    }
+
+    // PxIES selects the falling edge for a bit, otherwise the rising edge is latched
+    P1IFG |= (~p1 & P1IN & ~P1IES) | (p1 & ~P1IN & P1IES);
+    P2IFG |= (~p2 & P2IN & ~P2IES) | (p2 & ~P2IN & P2IES);
+
+#if INPUT_IRQ
+    if (P1IE & P1IFG) {
+        PORT1_handler();
+        port_calls++;
+        run_main();
+    }
+    if (P2IE & P2IFG) {
+        PORT2_handler();
+        port_calls++;
+        run_main();
+    }
+#endif
+    check_start(0);
+}
+
+// note when the car comes to rest, and how far from the floor it stopped
+static void track_rest(void) {
+
+    int resting = car_at_rest(), closed = closed_switch();
+
+    if (closed && !switch_was_closed) {
+        switch_speed = fabs(car_vel);
+    }
+    switch_was_closed = closed;
+
+    if (resting && !car_resting) {
+
+        car_rest_since = now;
+        if (closed) {
+
+            double err = fabs(car_pos - floor(car_pos + 0.5));
+
+            stops++;
+            sum_stop_err += err;
+            if (err > max_stop_err) {
+                max_stop_err = err;
+            }
+            sum_landing += switch_speed;
+            if (switch_speed > max_landing) {
+                max_landing = switch_speed;
+            }
+        }
+    }
+    car_resting = resting;
+}
+
+// ================ PASSENGER EVENTS ================
+
+// press the hall button while waiting, the destination button while riding
+static void press(struct passenger *p) {
+
+    p->press_tower = (p->status == WAITING);
+    p->press_addr = p->press_tower ? TOWER_ADDR(p->origin, p->dest > p->origin) : p->dest - 1;
+    p->press_until = now + PRESS_S;
+    p->next_press = now + REPRESS_S;
+    presses[p->press_tower ? IN_TOWER : IN_ELEV]++;
+}
+
+static void add_passenger(void) {
+
+    struct passenger *p;
+
+    if (num_pax == cap_pax) {
+        cap_pax = cap_pax ? cap_pax * 2 : 256;
+        pax = realloc(pax, cap_pax * sizeof(*pax));
+        active = realloc(active, cap_pax * sizeof(*active));
+        if (!pax || !active) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    active[num_active++] = num_pax;
+    p = &pax[num_pax++];
+    memset(p, 0, sizeof(*p));
+    p->status = WAITING;
+    p->origin = 1 + (int)(rng_uniform() * NUM_FLOORS);
+    do {
+        p->dest = 1 + (int)(rng_uniform() * NUM_FLOORS);
+    } while (p->dest == p->origin);
+    p->t_arrive = now;
+    press(p);
+}
+
+// boarding, alighting, repeated presses and giving up, evaluated on every slice
+static void update_passengers(void) {
+
+    int i, floor = car_at_rest() ? closed_switch() : 0;
+
+    // riders leave first so the car has room for those waiting
+    for (i = 0; i < num_active; i++) {
+
+        struct passenger *p = &pax[active[i]];
+
+        if (p->status != RIDING) {
+            continue;
+        }
+        if (floor && p->dest == floor) {
+            p->status = DELIVERED;
+            p->t_exit = now;
+            car_riders--;
+        }
+        else if (floor && now - car_rest_since >= GIVE_UP_S && now - p->t_board >= GIVE_UP_S) {
+            // stuck at the wrong floor, get out and call again from here
+            p->status = WAITING;
+            p->origin = floor;
+            press(p);
+            car_riders--;
+        }
+        else if (now >= p->next_press) {
+            press(p);
+        }
+    }
+
+    for (i = 0; i < num_active; i++) {
+
+        struct passenger *p = &pax[active[i]];
+
+        if (p->status != WAITING) {
+            continue;
+        }
+        if (floor == p->origin && car_riders < CAR_CAPACITY && now >= p->press_until) {
+            p->status = RIDING;
+            p->t_board = now;
+            press(p);
+            car_riders++;
+        }
+        else if (now - p->t_arrive >= ABANDON_S) {
+            p->status = ABANDONED;
+        }
+        else if (now >= p->next_press) {
+            press(p);
+        }
+    }
+
+    // drop everyone who is done from the active list
+    for (i = 0; i < num_active; ) {
+        if (pax[active[i]].status == DELIVERED || pax[active[i]].status == ABANDONED) {
+            active[i] = active[--num_active];
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+// earliest future time at which a passenger does something on their own
+static double next_passenger_event(double next_arrival) {
+
+    double t = next_arrival;
+    int i;
+
+    for (i = 0; i < num_active; i++) {
+
+        struct passenger *p = &pax[active[i]];
+
+        if (p->status == WAITING || p->status == RIDING) {
+            if (p->press_until + BOUNCE_S > now && p->press_until + BOUNCE_S < t) {
+                t = p->press_until + BOUNCE_S;
+            }
+            if (p->next_press < t) {
+                t = p->next_press;
+            }
+        }
+        if (p->status == WAITING && p->t_arrive + ABANDON_S < t) {
+            t = p->t_arrive + ABANDON_S;
+        }
+    }
+    return t;
+}
+
+// ================ REPORTING ================
+
+static int cmp_double(const void *a, const void *b) {
+
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(double hours, double wall_s, int per_passenger) {
+
+    int i, delivered = 0, abandoned = 0, pending = 0;
+    double *wait = malloc((num_pax + 1) * sizeof(double));
+    double sum_wait = 0.0, sum_ride = 0.0, max_ride = 0.0;
+
+    if (per_passenger) {
+        printf("id,origin,dest,arrive_s,wait_s,ride_s,status\n");
+    }
+
+    for (i = 0; i < num_pax; i++) {
+
+        struct passenger *p = &pax[i];
+
+        if (p->status == DELIVERED) {
+
+            double w = p->t_board - p->t_arrive, r = p->t_exit - p->t_board;
+
+            wait[delivered++] = w;
+            sum_wait += w;
+            sum_ride += r;
+            if (r > max_ride) {
+                max_ride = r;
+            }
+            if (per_passenger) {
+                printf("%d,%d,%d,%.3f,%.3f,%.3f,delivered\n",
+                       i, p->origin, p->dest, p->t_arrive, w, r);
+            }
+        }
+        else {
+            if (p->status == ABANDONED) {
+                abandoned++;
+            }
+            else {
+                pending++;
+            }
+            if (per_passenger) {
+                printf("%d,%d,%d,%.3f,,,%s\n", i, p->origin, p->dest, p->t_arrive,
+                       p->status == ABANDONED ? "abandoned" : "pending");
+            }
+        }
+    }
+
+    qsort(wait, delivered, sizeof(double), cmp_double);
+
+    printf("simulated     %.2f h, %lu WDT ticks, %lu handler calls, %.3f s wall\n",
+           hours, tick, isr_calls, wall_s);
+    printf("port irqs     %lu handler calls, %u events dropped\n", port_calls, events_dropped);
+    printf("deep idle     %.1f %% of the time in LPM3\n", 100.0 * lpm3_s / (hours * 3600.0));
+    printf("start-up      in service after %.2f s\n", in_service_s);
+    printf("passengers    %d arrived, %d delivered, %d abandoned, %d in progress\n",
+           num_pax, delivered, abandoned, pending);
+    printf("throughput    %.1f passengers/h\n", delivered / hours);
+
+    if (delivered) {
+        printf("wait time     mean %.1f s, p95 %.1f s, max %.1f s\n",
+               sum_wait / delivered, wait[(int)(0.95 * (delivered - 1))],
+               wait[delivered - 1]);
+        printf("ride time     mean %.1f s, max %.1f s\n", sum_ride / delivered, max_ride);
+    }
+    if (stops) {
+        printf("stop error    mean %.3f, max %.3f floors from centre over %lu stops\n",
+               sum_stop_err / stops, max_stop_err, stops);
+        printf("landing       mean %.2f, max %.2f floors/s as the switch closes\n",
+               sum_landing / stops, max_landing);
+    }
+    if (travel_floors > 0.0) {
+        printf("travel        %.2f s per floor, peak speed %.2f floors/s\n",
+               travel_s / travel_floors, peak_speed);
+        printf("by load       %.2f s per floor empty, %.2f s with %d or more riders\n",
+               load_travel_s[0] / load_travel_floors[0],
+               load_travel_floors[1] > 0.0 ? load_travel_s[1] / load_travel_floors[1] : 0.0,
+               CAR_CAPACITY / 2);
+    }
+    printf("inputs        hall %u of %lu presses, car %u of %lu, limit %u of %lu closures "
+           "seen by the firmware\n", input_presses[IN_TOWER], presses[IN_TOWER],
+           input_presses[IN_ELEV], presses[IN_ELEV], input_presses[IN_LIMIT], presses[IN_LIMIT]);
+    if (starts) {
+        printf("idle starts   %lu, button to motor mean %.1f ms, max %.1f ms, %lu over %.0f ms\n",
+               starts, 1000.0 * sum_start_s / starts, 1000.0 * max_start_s, slow_starts,
+               1000.0 * START_VISIBLE_S);
+    }
+    {
+        unsigned long work[2] = { 0, 0 };
+
+        for (i = 0; i < FLOOR_SEGMENTS; i++) {
+            work[0] += target_work[0][i];
+            work[1] += target_work[1][i];
+        }
+        printf("calibration   dead band %u up, %u down; %lu up, %lu down work per floor\n",
+               motor_deadband[0], motor_deadband[1], work[0] / FLOOR_SEGMENTS,
+               work[1] / FLOOR_SEGMENTS);
+    }
+
+    free(wait);
+}
+
+// ================ MAIN PROGRAM ================
+
+static void usage(const char *prog) {
+
+    fprintf(stderr,
+            "usage: %s [-r arrivals/h] [-H hours] [-s seed] [-f start floor] [-m motor gain] [-w] [-p]\n"
+            "  -m  speed per unit duty relative to the nominal motor, e.g. 0.8 for a weak battery\n"
+            "  -w  warm restart: the firmware's saved state has the car parked at the start floor\n"
+            "  -p  print one CSV line per passenger before the summary\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+
+    double rate = 60.0, hours = 24.0, end, next_arrival;
+    double start_floor = (NUM_FLOORS + 1) / 2.0;
+    int i, per_passenger = 0, warm = 0;
+    clock_t wall = clock();
+
+    for (i = 1; i < argc; i++) {
+
+        if (!strcmp(argv[i], "-p")) {
+            per_passenger = 1;
+        }
+        else if (i + 1 < argc && !strcmp(argv[i], "-r")) {
+            rate = atof(argv[++i]);
+        }
+        else if (i + 1 < argc && !strcmp(argv[i], "-H")) {
+            hours = atof(argv[++i]);
+        }
+        else if (i + 1 < argc && !strcmp(argv[i], "-s")) {
+            rng_state ^= strtoull(argv[++i], NULL, 0) * 0xBF58476D1CE4E5B9ULL;
+        }
+        else if (!strcmp(argv[i], "-w")) {
+            warm = 1;
+        }
+        else if (i + 1 < argc && !strcmp(argv[i], "-m")) {
+            motor_gain = MOTOR_GAIN * atof(argv[++i]);
+        }
+        else if (i + 1 < argc && !strcmp(argv[i], "-f")) {
+            start_floor = atof(argv[++i]);
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+    if (rate <= 0.0 || hours <= 0.0 || start_floor < 1.0 || start_floor > NUM_FLOORS) {
+        usage(argv[0]);
+    }
+
+    end = hours * 3600.0;
+    car_pos = start_floor - 1.0;
+    next_arrival = rng_exponential(3600.0 / rate);
+
+    memset(host_info_d, 0xFF, sizeof(host_info_d)); // erased flash, nothing calibrated
+    sample_inputs();
+#if WARM_RESTART
+    if (warm) {
+        // the record a previous session would have left with the car parked here
+        state = 'x';
+        current_floor = (unsigned char)start_floor;
+        save_warm_state();
+        state = 'i';
+        current_floor = 0;
+    }
+#else
+    if (warm) {
+        usage(argv[0]); // the firmware keeps no state across a reset
+    }
+#endif
+    init_system();
+    run_main();
+    car_resting = car_at_rest();
+
+    while (now < end) {
+
+        unsigned char prev_state = state, prev_p2 = P2OUT;
+        unsigned short prev_ccr = TA0CCR1;
+        unsigned int prev_dwell = dwell;
+        double next_event, next_tick = (tick + 1) * TICK_S;
+
+        // passengers and inputs act at the start of each slice, the car moves through it
+        while (now < next_tick) {
+
+            double dt = TICK_S / SUBSTEPS;
+
+            while (next_arrival <= now) {
+                add_passenger();
+                next_arrival += rng_exponential(3600.0 / rate);
+            }
+            update_passengers();
+            drive_inputs();
+
+            if (dt > next_tick - now) {
+                dt = next_tick - now;
+            }
+            if (!car_at_rest()) {
+                double from = car_pos;
+
+                move_car(dt);
+                travel_s += dt;
+                travel_floors += fabs(car_pos - from);
+                if (car_riders == 0 || car_riders >= CAR_CAPACITY / 2) {
+                    load_travel_s[car_riders != 0] += dt;
+                    load_travel_floors[car_riders != 0] += fabs(car_pos - from);
+                }
+                if (fabs(car_vel) > peak_speed) {
+                    peak_speed = fabs(car_vel);
+                }
+            }
+            else {
+                move_car(dt);
+            }
+            if (!smclk_running()) {
+                lpm3_s += dt;
+            }
+            else if (TA1CTL & MC_2) {
+                smclk_us += dt * 1e6;
+                TA1R = (unsigned short)fmod(smclk_us, 65536.0);
+            }
+            now += dt;
+            track_rest();
+        }
+
+        tick++;
+        now = next_tick;
+        if (in_service_s < 0.0 && (state == 'x' || state == 'w')) {
+            in_service_s = now;
+        }
+        drive_inputs();
+        if (wdt_running()) {
+            WDT_interval_handler();
+            isr_calls++;
+            run_main();
+            check_start(1);
+        }
+
+        // the handler only reacts to its inputs while parked in 'x' with the dwell over
+        // ('w' times out), so once the car has settled and a whole tick after the dwell
+        // changed nothing, skip ahead to the next passenger event
+        if (state == 'x' && !dwell && !prev_dwell && state == prev_state &&
+            P2OUT == prev_p2 &&
+            TA0CCR1 == prev_ccr && car_at_rest() && car_vel == 0.0) {
+
+            next_event = next_passenger_event(next_arrival);
+            for (i = 0; i < num_active; i++) {
+                if (now < pax[active[i]].press_until + BOUNCE_S) {
+                    next_event = now; // a button is still held
+                }
+            }
+            if (next_event > end) {
+                next_event = end;
+            }
+            if (next_event > now + TICK_S) {
+
+                // resume mid-tick at the event itself so a port interrupt sees it at once
+                if (!smclk_running()) {
+                    lpm3_s += next_event - now;
+                }
+                tick = (unsigned long)floor(next_event / TICK_S);
+                now = next_event;
+            }
+        }
+    }
+
+    report(hours, (double)(clock() - wall) / CLOCKS_PER_SEC, per_passenger);
+    free(pax);
+    free(active);
+    return 0;
+}
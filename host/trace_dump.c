@@ -0,0 +1,97 @@
+/*
+ * Elevator Control System - state trace report
+ * Copyright 2015 Carlton Duffett and Neeraj Basu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Lists the state changes kept by a firmware built with STATE_TRACE (the default),
+ * oldest first, from a hex dump of the trace variable in the format of mspdebug's md
+ * command, read from the board at any time, including after a reset:
+ *
+ *  mspdebug rf2500 "sym import elevator.elf" "md trace 68" | ./trace_dump
+ *
+ * The dump is parsed by host/md_dump.h, as for host/profile_dump.c. Build on the host
+ * with:
+ *
+ *  cc -O2 -o trace_dump host/trace_dump.c
+ */
+
+#include <stdio.h>
+
+#define STATE_TRACE     1
+
+#include "../hal.h"
+#include "../elevator.h"
+#include "md_dump.h"
+
+// layout of struct state_trace on the device: magic and head, then four bytes per record
+// (16-bit tick, states, input), little endian
+#define HEADER_BYTES    4
+#define RECORD_BYTES    4
+#define TRACE_BYTES     (HEADER_BYTES + TRACE_RECORDS * RECORD_BYTES)
+#define TRACE_MAGIC     0x7ACE
+
+// seconds per WDT tick
+#define TICK_S          0.008192
+
+static unsigned char dump[TRACE_BYTES];
+
+// states by their low nibble, '-' before a reset
+static const char state_names[17] = "-??cduvwxi????^?";
+
+static const char *const source_names[4] = { "tick", "tower", "car", "limit" };
+
+int main(void) {
+
+    int n = read_md_dump(dump, TRACE_BYTES);
+    unsigned int head, count, k;
+
+    if (n < TRACE_BYTES) {
+        fprintf(stderr, "trace_dump: read %d of %d bytes, dump the whole trace\n",
+                n, TRACE_BYTES);
+        return 1;
+    }
+    if (word_at(dump) != TRACE_MAGIC) {
+        fprintf(stderr, "trace_dump: no trace, wrong build or not started yet\n");
+        return 1;
+    }
+
+    head = word_at(dump + 2);
+    count = (head < TRACE_RECORDS) ? head : TRACE_RECORDS;
+
+    printf("%6s %9s  %-8s %s\n", "tick", "seconds", "change", "input");
+
+    for (k = head - count; k != head; k++) {
+
+        const unsigned char *r = &dump[HEADER_BYTES + (k & TRACE_MASK) * RECORD_BYTES];
+        unsigned int tick = word_at(r);
+        unsigned char states = r[2], input = r[3], value = input & ~TRACE_SOURCE;
+
+        printf("%6u %9.2f  '%c'->'%c' ", tick, tick * TICK_S,
+               state_names[states >> 4], state_names[states & 0x0F]);
+
+        if (!(states >> 4)) {
+            printf(" reset\n");
+        }
+        else if ((input & TRACE_SOURCE) == TRACE_TICK) {
+            printf(" tick at floor %u\n", value);
+        }
+        else if (value) {
+            printf(" %s address %u\n", source_names[input >> 6], value - 1);
+        }
+        else {
+            printf(" %s released\n", source_names[input >> 6]);
+        }
+    }
+    return 0;
+}
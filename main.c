@@ -1,4 +1,5 @@
-#include <msp430g2553.h>
+#include "hal.h"
+#include "elevator.h"
 
 /*
  * Elevator Control System
@@ -36,17 +37,55 @@
  * ELEV_    In-elevator call buttons that user presses to select desired destination
  * LIMIT_   On-tower limit switches that detect the absolute position of the elevator car
  *
- * This system has a very basic control algorithm. The elevator may be called to only one
- * floor and sent to only one destination at a time. Future versions will have a more
- * sophisticated control scheme.
+ * Every call is recorded in a set of pending calls (hall up, hall down and in-car, one bit
+ * per floor) as soon as the button is seen, whatever the car is doing. With collective
+ * control (the default) the car keeps sweeping in one direction, stopping at every floor
+ * with a car call or a hall call in its direction, and reverses only when nothing is
+ * pending ahead. Every stop lasts DWELL_TICKS so riders can get on and off. A rider can
+ * select any floor, even while the car is moving: one on the car's way is a stop like any
+ * other, one behind it is served after the car turns round (see RIDER_REVERSAL).
  *
- * Because of the way the priority encoders work, the P1 and P2 interrupts cannot be used
- * to detect button presses. Polling by the Watchdog Timer (WDT) is used instead.
+ * A priority encoder's EN line stays high while any of its inputs is held, so a second
+ * press on the same encoder, or a bouncing contact, produces no clean edge. With INPUT_IRQ
+ * (see elevator.h) the rising edge of each EN line raises a P1/P2 interrupt that handles
+ * the first press at once and then masks itself. The Watchdog Timer (WDT) polls only the
+ * encoders whose interrupt is masked, those held (or high at reset), and re-arms each one
+ * once it is released. Without INPUT_IRQ every encoder is polled on every WDT tick.
+ *
+ * Every sample of an encoder, whether from a port interrupt or a WDT tick, goes through a
+ * debouncer first, so each physical press or switch closure reaches its handler exactly
+ * once however long it is held or however much the contact bounces.
+ *
+ * With DEEP_IDLE, a car parked in 'x' with nothing pending stops the WDT and the
+ * PWM timer and sleeps in LPM3 (ACLK on the VLO, DCO off). A button edge raises a port
+ * interrupt that only queues the press and wakes main(), which restarts both timers and,
+ * if there is somewhere to go, starts the motor as it handles the event.
+ * The time from the button edge to the motor outputs being written is kept in
+ * wake_latency and wake_latency_max.
+ *
+ * The interrupt handlers do no control work. Each one samples P1IN and P2IN into a
+ * single-producer/single-consumer event queue and wakes main(), which drains the queue
+ * and runs the handlers and the state machine below with interrupts enabled.
+ *
+ * The motor duty cycle follows a trapezoidal profile: the car starts and stops at a floor
+ * duty, ramps up to a cruise duty between floors and ramps down again before a stop. The
+ * brake point comes from the distance covered so far, estimated from the duty and
+ * calibrated on every limit switch the car passes. A PI controller on the same
+ * measurement scales the duty so that each floor takes the same time as load and supply
+ * drift.
+ *
+ * The floor is shown on the seven-segment display through a table of port bits. With
+ * DISPLAY_STATUS the spare codes 5 - 7 alternate with the floor while the car travels up,
+ * travels down or waits for a destination.
+ *
+ * With WARM_RESTART the floor and the pending calls survive a reset in RAM the startup
+ * code leaves alone, so a car resting on a limit switch resumes service without homing.
  *
  * The possible states of the system are:
  *
  * 'i'  - initializing elevator to a known position (on reset the car defaults to the first floor)
- * 'x'  - idle, waiting to be called to a floor
+ * 'c'  - timing the shaft for the motion profile, once after homing (BOOT_CALIBRATION)
+ * 'x'  - idle, serving the next pending call once the dwell time has passed
  * '^'  - going up to a called floor to receive a passenger
  * 'v'  - going down to a called floor to receive a passenger
  * 'w'  - waiting at called floor for user to select destination
@@ -55,34 +94,106 @@
  *
  */
 
-// port 1 bit mask
-#define SEVENSEG_A0     0x01    // seven segment display addresses
-#define SEVENSEG_A1     0x02
-#define PWM             0x04    // pulse-width modulation for motor control
-#define SEVENSEG_A2     0x08
-#define TOWER_EN        0x10    // on-tower call buttons, enable
-#define TOWER_A0        0x20    // on-tower call buttons, addresses
-#define TOWER_A1        0x40
-#define TOWER_A2        0x80
-
-// port 2 bit mask
-#define LIMIT_EN        0x01    // limit switches, enable
-#define LIMIT_A0        0x02    // limit switches, addresses
-#define LIMIT_A1        0x04
-#define ELEV_EN         0x08    // in-elevator buttons, enable
-#define ELEV_A0         0x10    // in-elevator buttons, addresses
-#define ELEV_A1         0x20
-#define UPCTL           0x40    // up direction selection for motor control
-#define DNCTL           0x80    // down direction selection for motor control
-
 // state variables
 volatile unsigned char state = 'i';         // state of the system
 volatile unsigned char current_floor = 0;   // current location of elevator car
-volatile unsigned char called_floor;        // floor elevator was called to
-volatile unsigned char destination;         // floor that user selects as destination
-volatile unsigned char dest_direction;      // direction (up/down) that user's destination is in
+volatile unsigned char target_floor;        // floor the car is currently sent to
+volatile unsigned char dest_direction = 'u'; // direction (up/down) that user's destination is in
+volatile unsigned int dwell = 0;            // ticks left before the car may leave a floor
+volatile unsigned int wait_ticks = 0;       // ticks in 'w' since the dwell ran out
+
+// events queued by the interrupt handlers for main(), each with a sample of P1IN and P2IN
+#define EVENT_QUEUE     16  // power of two
+#define EVENT_MASK      (EVENT_QUEUE - 1)
+
+// an event is the set of encoders to decode from its sample, or a WDT tick
+#define EV_TOWER        0x01    // rising edge on TOWER_EN
+#define EV_LIMIT        0x02    // rising edge on LIMIT_EN
+#define EV_ELEV         0x04    // rising edge on ELEV_EN
+#define EV_ENCODERS     (EV_TOWER + EV_LIMIT + EV_ELEV)
+#define EV_TICK         0x80    // WDT interval, every encoder is decoded
+
+volatile unsigned char event_type[EVENT_QUEUE];
+volatile port_sample_t event_p1[EVENT_QUEUE];
+volatile port_sample_t event_p2[EVENT_QUEUE];
+volatile unsigned char event_head = 0;      // next slot to fill, written only by the handlers
+volatile unsigned char event_tail = 0;      // next slot to handle, written only by main()
+volatile unsigned int events_dropped = 0;   // events lost to a full queue
+volatile unsigned int isr_time_max = 0;     // longest interrupt handler, in SMCLK cycles
+
+#if DEEP_IDLE
+volatile unsigned char deep_idle = 0;       // set while sleeping in LPM3
+volatile unsigned int wake_stamp;           // TA1R on entry to the last port interrupt
+volatile unsigned int wake_latency;         // wake-up to motor start, last and worst (us)
+volatile unsigned int wake_latency_max;
+unsigned char wake_starting;                // motor started on a wake-up, outputs not written yet
+#endif
+
+// output shadows: the control code only changes these, and commit_outputs() writes a
+// port or the PWM compare register once per pass, and only if its value changed
+unsigned char p1_out, p2_out;               // wanted P1OUT (display) and P2OUT (motor direction)
+unsigned int duty_out;                      // wanted TA0CCR1
+unsigned char p1_written, p2_written;       // values last written to the hardware
+unsigned int duty_written;
+
+
+// pending calls, one bit per floor (bit 0 = floor 1)
+#if NUM_FLOORS <= 8
+typedef unsigned char floor_mask_t;
+#elif NUM_FLOORS <= 16
+typedef unsigned int floor_mask_t;
+#elif NUM_FLOORS <= 32
+typedef unsigned long floor_mask_t;
+#else
+typedef unsigned long long floor_mask_t;
+#endif
+
+volatile floor_mask_t hall_up_calls;    // on-tower up buttons
+volatile floor_mask_t hall_dn_calls;    // on-tower down buttons
+volatile floor_mask_t car_calls;        // in-elevator buttons
+
+#define FLOOR_BIT(floor)    ((floor_mask_t)1 << ((floor) - 1))
+#define FLOORS_ABOVE(floor) ((floor_mask_t)~((FLOOR_BIT(floor) << 1) - 1))
+#define FLOORS_BELOW(floor) ((floor_mask_t)(FLOOR_BIT(floor) - 1))
+
+// lowest and highest floor set in a mask, 0 for an empty mask
+#if NUM_FLOORS <= 4
+// MSP430 has no bit-scan instruction, so a 4-floor mask indexes a table in flash
+const unsigned char lowest_floor_table[16]  = { 0, 1, 2, 1, 3, 1, 2, 1, 4, 1, 2, 1, 3, 1, 2, 1 };
+const unsigned char highest_floor_table[16] = { 0, 1, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4 };
+#define lowest_floor(mask)  lowest_floor_table[mask]
+#define highest_floor(mask) highest_floor_table[mask]
+#elif defined(__GNUC__)
+#define lowest_floor(mask)  ((mask) ? __builtin_ctzll(mask) + 1 : 0)
+#define highest_floor(mask) ((mask) ? 64 - __builtin_clzll(mask) : 0)
+#else
+#error "no bit scan available for more than 4 floors"
+#endif
+
+// time the car stays at a floor before leaving for the next call
+#define DWELL_TICKS     250 // ~2 s at 8 ms per tick
+
+// time a car in 'w' waits after the dwell for a destination before it gives up on the
+// riders it stopped for (e.g. -DWAIT_TIMEOUT_TICKS=2500 for ~20 s)
+#ifndef WAIT_TIMEOUT_TICKS
+#define WAIT_TIMEOUT_TICKS  1000 // ~8 s
+#endif
+
+// collective control: stop for every same-direction call on the way and reverse only
+// when nothing is pending ahead (set to 0 to serve one call per trip, nearest first)
+#ifndef COLLECTIVE_CONTROL
+#define COLLECTIVE_CONTROL  1
+#endif
+
+// a rider who picks a floor the other way from the hall button they pressed is carried
+// there after the car has served everything ahead (0), or, when nobody else aboard is
+// going the car's way, turns the car round before it leaves the floor (1)
+#ifndef RIDER_REVERSAL
+#define RIDER_REVERSAL  0
+#endif
 
 // initialization functions
+void init_system(void);
 void init_motor_control(void);
 void init_limit_switches(void);
 void init_elev_buttons(void);
@@ -91,32 +202,165 @@ void init_timerA(void);
 void init_7segment(void);
 void init_WDT(void);
 
+// low-power functions
+void sleep_deep(void);
+void wake_up(void);
+
 // motor control functions
 void stop_motor(void);
 void go_up(void);
 void go_down(void);
+void commit_outputs(void);
 
-// duty cycle settings for up/down (out of 1000)
+// duty cycle settings for up/down (out of 1000), used to start and stop at a floor
 #define UP_DUTY_CYCLE   400 // 40 %
 #define DN_DUTY_CYCLE   300 // 30 %
 
+// motion profile: cruise duty between floors and slew per WDT tick
+#define UP_CRUISE_DUTY  600 // 60 %
+#define DN_CRUISE_DUTY  450 // 45 %
+#define RAMP_STEP       4   // 50 ticks (~0.4 s) between floor and cruise duty going up
+
+// predictive braking, the work figures are defaults for a car with no boot calibration
+#define MOTOR_DEADBAND  100     // duty below which the gearbox does not turn
+#define APPROACH_TICKS  30      // ticks at floor duty wanted before the switch closes
+#define UP_FLOOR_WORK   100000  // first guess at the work per floor, on the short side
+#define DN_FLOOR_WORK   80000   // so the first trips brake early rather than late
+#define FLOOR_WORK_GAIN 2       // each floor moves the estimate 1/4 of the way
+
+// speed regulation: a PI controller scales the profile duty above the dead band so each
+// floor takes the work (duty-weighted travel time) of the unloaded car on a full supply
+#define UP_TARGET_WORK  125000
+#define DN_TARGET_WORK  100000
+#define SPEED_KP_SHIFT  2       // proportional gain 1/4
+#define SPEED_KI_SHIFT  3       // integral gain 1/8 per floor
+#define SPEED_ERR_MAX   64      // 25 %, clamp for floors cut short or stretched by a late call
+#define SPEED_GAIN_MIN  128     // duty scale 0.5 to 2, Q8
+#define SPEED_GAIN_MAX  512
+#define MAX_DUTY        950     // leave the PWM a low phase on every period
+
+// direction of travel while moving, dest_direction is the call direction without
+// collective control
+#define TRAVELLING_DOWN (state == 'v' || state == 'd' || state == 'i')
+
+// distance is estimated as the sum over WDT ticks of the duty above the dead band
+// tables are indexed by direction (up, down), set up by load_calibration()
+unsigned int motor_deadband[2];
+unsigned long travel_work;      // since the car left or passed the last floor
+unsigned long floor_work[2][FLOOR_SEGMENTS];    // learned per segment
+unsigned long target_work[2][FLOOR_SEGMENTS];   // wanted per segment
+unsigned char braking;          // slowing down for the next floor
+unsigned int ramp_duty;         // profile duty, before speed regulation
+
+// speed regulation, per direction (up, down), Q8
+int speed_gain[2] = { 256, 256 };
+int speed_integral[2];
+
+// motion profile
+void start_profile(void);
+unsigned char stopping_next(void);
+unsigned long braking_work(unsigned int floor_duty);
+unsigned int profile_duty(unsigned int floor_duty, unsigned int cruise_duty);
+void learn_floor_work(void);
+void regulate_speed(unsigned char segment);
+unsigned int regulated_duty(void);
+
+// boot calibration
+void load_calibration(void);
+
+// warm restart
+#if WARM_RESTART
+unsigned char warm_check(void);
+void warm_start(void);
+#endif
+#if STATE_TRACE
+// state trace
+void trace_start(void);
+void trace_state(unsigned char before, unsigned char source);
+#endif
+struct calibration;
+void apply_calibration(const struct calibration *table);
+#if BOOT_CALIBRATION
+unsigned int calibration_check(const struct calibration *table);
+unsigned char calibration_valid(const struct calibration *table);
+void write_info_flash(volatile unsigned int *segment, const unsigned int *words, unsigned int count);
+void calibrate_floor(void);
+void calibrate_tick(void);
+void finish_calibration(void);
+#endif
+
 // control handlers
-void update_display(unsigned char floor);
-unsigned char get_tower_addr(void);
-unsigned char get_elev_addr(void);
-unsigned char get_limit_addr(void);
+void update_display(unsigned char code);
+#if DISPLAY_STATUS
+unsigned char status_glyph(void);
+void update_status_display(void);
+#endif
+unsigned char get_tower_addr(port_sample_t p1);
+unsigned char get_elev_addr(port_sample_t p2);
+unsigned char get_limit_addr(port_sample_t p2);
 
 void handle_tower_button(unsigned char addr);
 void handle_elev_button(unsigned char addr);
 void handle_limit_switch(unsigned char addr);
 
+// input debouncing functions
+unsigned char tower_code(port_sample_t p1);
+unsigned char elev_code(port_sample_t p2);
+unsigned char limit_code(port_sample_t p2);
+unsigned char debounce(unsigned char input, unsigned char code);
+unsigned char read_encoders(port_sample_t p1, port_sample_t p2, unsigned char which);
+
+// dispatch functions
+unsigned char hall_call_here(unsigned char dir);
+unsigned char next_call_ahead(unsigned char dir);
+unsigned char floor_distance(unsigned char floor);
+unsigned char nearest_call(floor_mask_t calls);
+floor_mask_t floors_ahead(void);
+void answer_hall_call(void);
+void depart(unsigned char floor);
+void take_next_action(unsigned char moving);
+void arrive(void);
+void serve_next_call(void);
+
+// event queue and control loop
+void queue_event(unsigned char type);
+void run_events(void);
+unsigned char control_tick(port_sample_t p1, port_sample_t p2);
+
+#if PROFILE_EVENTS
+// profiling functions
+unsigned char event_path(unsigned char type);
+void profile_path(unsigned char path, unsigned int start);
+#endif
+
 // ================ MAIN PROGRAM ================
+
+// the host build (see hal.h) and the benchmark (bench/bench.c) supply their own main()
+// and drive the system directly
+#if !defined(HAL_HOST) && !defined(BENCH)
 int main(void) {
 
+    init_system();
+
+    // the interrupt handlers queue events, everything else runs here
+    for (;;) {
+        main_loop();
+    }
+}
+#endif
+
+// bring up the clock and every peripheral used by the controller
+void init_system(void) {
+
     // 1Mhz calibration for SMCLK clock
     BCSCTL1 = CALBC1_1MHZ;
     DCOCTL  = CALDCO_1MHZ;
 
+#if DEEP_IDLE
+    // ACLK from the VLO, there is no crystal to keep running in LPM3
+    BCSCTL3 |= LFXT1S_2;
+#endif
+
     // initialize the system
     init_motor_control();
     init_limit_switches();
@@ -125,9 +369,13 @@ int main(void) {
     init_7segment();
     init_timerA();
     init_WDT();
-	
-    // turn off CPU and enable interrupts
-    _bis_SR_register(GIE+LPM0_bits);
+    load_calibration();
+#if WARM_RESTART
+    warm_start();
+#endif
+#if STATE_TRACE
+    trace_start();
+#endif
 }
 
 // ================ INITIALIZATION FUNCTIONS ================
@@ -145,8 +393,15 @@ void init_motor_control(void) {
     P2SEL &= ~UPCTL; // disconnect from XOUT
     P2SEL &= ~DNCTL; // disconnect from XIN
 
+    // start braked, the state machine decides where to go
+    p2_out = UPCTL + DNCTL;
+    p2_written = p2_out;
+    P2OUT = p2_written;
+
     // setup default PWM length (50%)
-    TA0CCR1 = 500;    // on for 8/16 cycles
+    duty_out = 500;   // on for 8/16 cycles
+    duty_written = duty_out;
+    TA0CCR1 = duty_written;
     TA0CCR0 = 999;    // off for 8/16 cycles
 }
 
@@ -158,6 +413,17 @@ void init_limit_switches(void) {
     P2DIR &= ~LIMIT_EN;
     P2DIR &= ~LIMIT_A0; // 4 limit switches = 2 bit address
     P2DIR &= ~LIMIT_A1;
+
+#if INPUT_IRQ
+    // interrupt on the rising edge of EN
+    // a line already high (the car resting on a switch) has no edge to come, so it is left
+    // masked for the WDT to poll, and armed once released like any held line
+    P2IES &= ~LIMIT_EN;
+    P2IFG &= ~LIMIT_EN;
+    if (!(P2IN & LIMIT_EN)) {
+        P2IE |= LIMIT_EN;
+    }
+#endif
 }
 
 // initialize in-elevator call buttons for user to select desired floor
@@ -166,6 +432,14 @@ void init_elev_buttons(void) {
     P2DIR &= ~ELEV_EN;
     P2DIR &= ~ELEV_A0;  // 4 call buttons = 2 bit address
     P2DIR &= ~ELEV_A1;
+
+#if INPUT_IRQ
+    P2IES &= ~ELEV_EN;
+    P2IFG &= ~ELEV_EN;
+    if (!(P2IN & ELEV_EN)) {
+        P2IE |= ELEV_EN;
+    }
+#endif
 }
 
 // initialize on-tower call buttons for user to call elevator to a floor
@@ -175,6 +449,14 @@ void init_tower_buttons(void) {
     P1DIR &= ~TOWER_A0; // 6 tower buttons = 3 bit address
     P1DIR &= ~TOWER_A1;
     P1DIR &= ~TOWER_A2;
+
+#if INPUT_IRQ
+    P1IES &= ~TOWER_EN;
+    P1IFG &= ~TOWER_EN;
+    if (!(P1IN & TOWER_EN)) {
+        P1IE |= TOWER_EN;
+    }
+#endif
 }
 
 // initialize timer A to drive a PWM signal
@@ -186,6 +468,9 @@ void init_timerA(void) {
                MC_1);       // UP mode
 
     TA0CCTL1 |= OUTMOD_7;   // reset/set mode
+
+    // timer A1 free-running on SMCLK, timestamps for handler lengths and wake-up latency
+    TA1CTL = TACLR + TASSEL_2 + ID_0 + MC_2;
 }
 
 // initialize the seven-segment display
@@ -195,6 +480,11 @@ void init_7segment(void) {
     P1DIR |= SEVENSEG_A0;
     P1DIR |= SEVENSEG_A1;
     P1DIR |= SEVENSEG_A2;
+
+    // show 0 until the car finds a floor (P1 has no other outputs, PWM is on P1SEL)
+    p1_out = 0;
+    p1_written = p1_out;
+    P1OUT = p1_written;
 }
 
 // initialize the watchdog timer
@@ -211,242 +501,916 @@ void init_WDT(void) {
   IE1 |= WDTIE;
 }
 
+// ================ LOW-POWER FUNCTIONS ================
+
+#if DEEP_IDLE
+
+// called on a WDT tick once the car is parked in 'x' with the dwell over:
+// let main() sleep in LPM3 if nothing can happen until a button is pressed
+void sleep_deep(void) {
+
+    if (hall_up_calls | hall_dn_calls | car_calls) {
+        return;
+    }
+
+    // a held button keeps its interrupt masked, and only the WDT would re-arm it
+    if (!(P1IE & TOWER_EN) || !(P2IE & ELEV_EN)) {
+        return;
+    }
+
+    // the car is parked, so the limit switch has nothing to say until it moves
+    P2IE &= ~LIMIT_EN;
+
+#if DISPLAY_STATUS
+    update_display(current_floor); // the display freezes here, leave the floor up
+#endif
+
+    // the timer stops wherever it is in the period, so drive the output high first: the
+    // enable stays on and the brake holds the car
+    TA0CCTL1 = OUTMOD_0 + OUT;
+    TA0CTL &= ~MC_1;            // stop the PWM timer
+    WDTCTL = WDTPW + WDTHOLD;   // stop the interval timer
+    deep_idle = 1; // main() sleeps in LPM3 once the queue is empty
+}
+
+// called for a button event: restart the timers stopped by sleep_deep
+// (the port handler has already woken main() from LPM3)
+void wake_up(void) {
+
+    if (!deep_idle) {
+        return;
+    }
+    deep_idle = 0;
+
+    TA0CCTL1 = OUTMOD_7;        // back to reset/set mode
+    TA0CTL |= TACLR + MC_1;
+    init_WDT();
+
+    // the limit switch is re-armed by the WDT once the car leaves this floor
+    P2IFG &= ~LIMIT_EN;
+
+    // take the call now rather than on the next WDT tick
+    if (state == 'x') {
+        serve_next_call();
+    }
+
+    // timed once commit_outputs() has driven the motor
+    wake_starting = (state != 'x' && state != 'w');
+}
+
+#endif // DEEP_IDLE
+
 // ================ MOTOR CONTROL FUNCTIONS ================
 
+// these only set the output shadows, see commit_outputs
+
 void stop_motor(void) {
     // set motor to stop mode
-    P2OUT |= UPCTL;
-    P2OUT |= DNCTL;
+    p2_out |= UPCTL;
+    p2_out |= DNCTL;
 }
 
 void go_up(void) {
 
     // set motor control signal to UP
-    P2OUT |= UPCTL;
-    P2OUT &= ~DNCTL;
+    p2_out |= UPCTL;
+    p2_out &= ~DNCTL;
 
     // use higher duty cycle in up direction
-    TA0CCR1 = UP_DUTY_CYCLE;
+    ramp_duty = profile_duty(UP_DUTY_CYCLE, UP_CRUISE_DUTY);
+    duty_out = regulated_duty();
 }
 
 void go_down(void) {
 
     // set motor control signal to DN
-    P2OUT &= ~UPCTL;
-    P2OUT |= DNCTL;
+    p2_out &= ~UPCTL;
+    p2_out |= DNCTL;
 
     // use lower duty cycle in down direction
-    TA0CCR1 = DN_DUTY_CYCLE;
+    ramp_duty = profile_duty(DN_DUTY_CYCLE, DN_CRUISE_DUTY);
+    duty_out = regulated_duty();
 }
 
-// ================ 7-SEGMENT DISPLAY ================
-void update_display(unsigned char floor) {
+// ================ MOTION PROFILE ================
+
+// Between floors the car cruises faster than it starts and stops. The duty cycle follows
+// a trapezoid, slewing RAMP_STEP per WDT tick between the floor duty (UP/DN_DUTY_CYCLE,
+// known to start the loaded car and to stop it cleanly at a limit switch) and the cruise
+// duty. It keeps cruising past floors it will not stop at.
+//
+// There is no position sensor between floors, so the distance from the last limit switch
+// is estimated from the duty: each tick adds the duty above the dead band to travel_work.
+// Each switch closure timestamps the end of a floor, and the work it took is learned per
+// direction and segment in floor_work, which follows the car's load and supply. The car starts
+// braking as soon as the work already done, plus the work of ramping down to the floor
+// duty, plus APPROACH_TICKS at the floor duty, reaches floor_work. It then reaches
+// the switch at the floor duty, whatever it is carrying.
+
+// set the car to start from the floor duty on the next go_up or go_down
+void start_profile(void) {
+
+    ramp_duty = 0;
+    travel_work = 0;
+    braking = 0;
+}
 
-    if (floor == 1) {
-        // 0b001
-        P1OUT |= SEVENSEG_A0;
-        P1OUT &= ~SEVENSEG_A1;
-        P1OUT &= ~SEVENSEG_A2;
-    }
-    else if (floor == 2) {
-        // 0b010
-        P1OUT &= ~SEVENSEG_A0;
-        P1OUT |= SEVENSEG_A1;
-        P1OUT &= ~SEVENSEG_A2;
+// 1 if the car stops at the next floor in its direction of travel
+unsigned char stopping_next(void) {
+
+    unsigned char down = TRAVELLING_DOWN;
+    unsigned char next = down ? current_floor - 1 : current_floor + 1;
+
+    if (state == 'i' || next < 1 || next > NUM_FLOORS) {
+        return 1; // position unknown, or no floor beyond this one
     }
-    else if (floor == 3) {
-        // 0b011
-        P1OUT |= SEVENSEG_A0;
-        P1OUT |= SEVENSEG_A1;
-        P1OUT &= ~SEVENSEG_A2;
+#if COLLECTIVE_CONTROL
+    {
+        // as in NA_PASS: stop for a car call or a hall call our way, or if nothing is beyond
+        floor_mask_t pending = hall_up_calls | hall_dn_calls | car_calls;
+        floor_mask_t beyond = down ? FLOORS_BELOW(next) : FLOORS_ABOVE(next);
+        floor_mask_t same = down ? hall_dn_calls : hall_up_calls;
+
+        return ((car_calls | same) & FLOOR_BIT(next)) || !(pending & beyond);
     }
-    else if (floor == 4) {
-        // 0b100
-        P1OUT &= ~SEVENSEG_A0;
-        P1OUT &= ~SEVENSEG_A1;
-        P1OUT |= SEVENSEG_A2;
+#else
+    return next == target_floor || (car_calls & FLOOR_BIT(next)) != 0;
+#endif
+}
+
+// work done while ramping down from ramp_duty to floor_duty
+unsigned long braking_work(unsigned int floor_duty) {
+
+    unsigned int steps;
+
+    if (ramp_duty <= floor_duty) {
+        return 0;
     }
+    steps = (ramp_duty - floor_duty) / RAMP_STEP;
+    return (unsigned long)steps * ((ramp_duty + floor_duty) / 2 - motor_deadband[TRAVELLING_DOWN]);
 }
 
-// ================ CONTROL HANDLERS ================
+// duty for this tick: ramp towards cruise, or back to the floor duty before a stop
+unsigned int profile_duty(unsigned int floor_duty, unsigned int cruise_duty) {
 
-// address masks
-#define TOWER_ADDR_MASK 0xE0
-#define ELEV_ADDR_MASK  0x30
-#define LIMIT_ADDR_MASK 0x06
+    unsigned int target = cruise_duty;
+    unsigned char down = TRAVELLING_DOWN;
+    unsigned char segment = down ? current_floor - 2 : current_floor - 1; // the one ahead
 
-// get the current address of the on-tower button that was pressed
-unsigned char get_tower_addr(void) {
+    if (state == 'i' || segment >= FLOOR_SEGMENTS) {
+        braking = 1; // position unknown, creep down to the first floor
+    }
+    else if (travel_work + braking_work(floor_duty) +
+             (unsigned long)APPROACH_TICKS * (floor_duty - motor_deadband[down]) >=
+             floor_work[down][segment]) {
+        braking = 1;
+    }
+    if (braking && stopping_next()) {
+        target = floor_duty;
+    }
 
-    // right shift the address bits into LSB position
-    return ((P1IN & TOWER_ADDR_MASK) >> 5);
+    if (ramp_duty < floor_duty) {
+        return floor_duty; // never below the duty that moves a loaded car
+    }
+    if (ramp_duty + RAMP_STEP < target) {
+        return ramp_duty + RAMP_STEP;
+    }
+    if (ramp_duty > target + RAMP_STEP) {
+        return ramp_duty - RAMP_STEP;
+    }
+    return target;
 }
 
-// get the current address of the in-elevator button that was pressed
-unsigned char get_elev_addr(void) {
+// called as a limit switch closes under a moving car: the floor just travelled took
+// travel_work, move the estimate for this direction towards it and start the next floor
+void learn_floor_work(void) {
 
-    return ((P2IN & ELEV_ADDR_MASK) >> 4);
-}
+    unsigned char down = TRAVELLING_DOWN;
+    unsigned char segment = down ? current_floor - 1 : current_floor - 2; // the one behind
+    unsigned long *work = &floor_work[down][segment];
 
-// get the current address of the limit switch that was pressed
-unsigned char get_limit_addr(void) {
+    if (segment >= FLOOR_SEGMENTS) {
+        return; // cannot happen once the position is known
+    }
+    regulate_speed(segment);
 
-    return ((P2IN & LIMIT_ADDR_MASK) >> 1);
+    if (travel_work > *work) {
+        *work += (travel_work - *work) >> FLOOR_WORK_GAIN;
+    }
+    else {
+        *work -= (*work - travel_work) >> FLOOR_WORK_GAIN;
+    }
+    travel_work = 0;
+    braking = 0;
 }
 
-// on-tower call button addresses
-#define F1_UP   0x7 // floor 1, up button
-#define F2_DN   0x6 // floor 2, down button
-#define F2_UP   0x5 // .. etc
-#define F3_DN   0x4
-#define F3_UP   0x3
-#define F4_DN   0x2
+// ================ SPEED REGULATION ================
 
-// handles a call event requesting the elevator to a specific floor
-// to be called, the elevator must currently be idle
-void handle_tower_button(unsigned char addr) {
+// The profile fixes the duty against time, so the work counted over a floor stands for the
+// time the floor took. A slow car (heavy load, weak battery) needs more work per floor
+// than the target, a fast one less. At every limit switch a PI controller turns the
+// relative error into a gain on the duty above the dead band, which holds the
+// floor-to-floor time at the target as the car drifts. The brake estimate above counts
+// profile duty, so it learns the regulated car.
+
+// called as a limit switch closes, before travel_work is cleared
+void regulate_speed(unsigned char segment) {
+
+    unsigned char down = TRAVELLING_DOWN;
+    long target = target_work[down][segment];
+    long error;
+    int gain;
+
+    if (target <= 0) {
+        return; // no target for this segment, keep the gain
+    }
+    error = ((long)travel_work - target) * 256 / target; // Q8, > 0 when slow
 
-    switch (addr) {
+    if (error > SPEED_ERR_MAX) {
+        error = SPEED_ERR_MAX;
+    }
+    else if (error < -SPEED_ERR_MAX) {
+        error = -SPEED_ERR_MAX;
+    }
+
+    speed_integral[down] += (int)error >> SPEED_KI_SHIFT;
+    if (speed_integral[down] > SPEED_GAIN_MAX - 256) {
+        speed_integral[down] = SPEED_GAIN_MAX - 256; // no wind-up beyond what the clamp allows
+    }
+    else if (speed_integral[down] < SPEED_GAIN_MIN - 256) {
+        speed_integral[down] = SPEED_GAIN_MIN - 256;
+    }
 
-    // First floor, up button
-    case F1_UP:
+    gain = 256 + ((int)error >> SPEED_KP_SHIFT) + speed_integral[down];
+    if (gain > SPEED_GAIN_MAX) {
+        gain = SPEED_GAIN_MAX;
+    }
+    else if (gain < SPEED_GAIN_MIN) {
+        gain = SPEED_GAIN_MIN;
+    }
+    speed_gain[down] = gain;
+}
 
-        if (state == 'x') { // elevator is currently idle
+// duty for ramp_duty under the current gain for the direction of travel
+unsigned int regulated_duty(void) {
 
-            called_floor = 1;
-            dest_direction = 'u';
+    unsigned char down = TRAVELLING_DOWN;
+    unsigned long duty;
 
-            // get current position of elevator and signal movement
-            if (current_floor != 1) {
-                go_down();
-                state = 'v'; // going down to called floor
+    if (ramp_duty <= motor_deadband[down]) {
+        return ramp_duty;
+    }
+    duty = motor_deadband[down] +
+           (((unsigned long)(ramp_duty - motor_deadband[down]) * speed_gain[down]) >> 8);
+    return (duty > MAX_DUTY) ? MAX_DUTY : (unsigned int)duty;
+}
+
+// ================ BOOT CALIBRATION ================
+
+// With BOOT_CALIBRATION, a controller with no calibration in flash runs the shaft once the
+// car has homed. It goes up and down once at the floor duty and once at the cruise duty,
+// without the profile, and times every segment in WDT ticks. The table of times is kept
+// in information memory segment D, so later resets only read it back. Holding an in-car
+// button through a reset forces a new calibration.
+//
+// At each boot, the speed above the dead band is taken as proportional to the duty. Two
+// runs at different duties then give the dead band for each direction, and the cruise run
+// gives the work per segment. These replace the compile-time defaults for braking and
+// speed regulation. Each run starts from rest, so its first segment is not timed at
+// steady speed and takes the mean of the others.
+
+#ifndef INFOD_START
+#define INFOD_START     0x1000  // information memory segment D, 64 bytes
+#endif
+
+#define CAL_RUNS        2
+#define CAL_MAGIC       0xCA1B
+#define CAL_PAUSE_TICKS 60      // ~0.5 s stopped at each end of the shaft
+#define CAL_TICKS_MAX   2441    // ~20 s for one floor, a car that slow is stuck
+
+struct calibration {
+    unsigned int magic;
+    unsigned int ticks[2][CAL_RUNS][FLOOR_SEGMENTS];    // up and down, per run and segment
+    unsigned int check;                                 // complement of the sum of the above
+};
+
+#define CAL_FLASH       ((struct calibration *)INFOD_START)
+
+#ifndef HAL_HOST
+typedef char calibration_fits[sizeof(struct calibration) <= 64 ? 1 : -1];
+#endif
+
+// duty of each run, up and down
+const unsigned int cal_duty[2][CAL_RUNS] = {
+    { UP_DUTY_CYCLE, UP_CRUISE_DUTY },
+    { DN_DUTY_CYCLE, DN_CRUISE_DUTY }
+};
+
+#if BOOT_CALIBRATION
+struct calibration cal;             // table being measured
+unsigned char cal_run = CAL_RUNS;   // run in progress, CAL_RUNS when not calibrating
+unsigned int cal_ticks;             // since the car left or passed the last floor
+#endif
+
+// derive the dead band and the work per segment from a table of times
+// a direction whose times make no sense keeps its defaults
+void apply_calibration(const struct calibration *table) {
+
+    unsigned char down, segment, steady;
+    unsigned long floor_ticks, cruise_ticks;
+    long deadband;
+
+    for (down = 0; down < 2; down++) {
+
+        // the leg starts from rest at the bottom going up, at the top going down
+        floor_ticks = cruise_ticks = 0;
+        steady = 0;
+        for (segment = 0; segment < FLOOR_SEGMENTS; segment++) {
+            if (FLOOR_SEGMENTS == 1 || segment != (down ? FLOOR_SEGMENTS - 1 : 0)) {
+                floor_ticks += table->ticks[down][0][segment];
+                cruise_ticks += table->ticks[down][1][segment];
+                steady++;
             }
-            else {
-                state = 'w'; // waiting for floor selection
+        }
+        if (cruise_ticks == 0 || floor_ticks <= cruise_ticks) {
+            continue; // the faster run was not faster
+        }
+
+        // (floor duty - dead band) * floor ticks = (cruise duty - dead band) * cruise ticks
+        deadband = ((long)cal_duty[down][0] * floor_ticks - (long)cal_duty[down][1] * cruise_ticks) /
+                   (long)(floor_ticks - cruise_ticks);
+        if (deadband < 0 || deadband >= (long)cal_duty[down][0]) {
+            continue;
+        }
+        motor_deadband[down] = deadband;
+
+        for (segment = 0; segment < FLOOR_SEGMENTS; segment++) {
+
+            unsigned long ticks = table->ticks[down][1][segment];
+
+            if (FLOOR_SEGMENTS > 1 && segment == (down ? FLOOR_SEGMENTS - 1 : 0)) {
+                ticks = cruise_ticks / steady;
             }
+            target_work[down][segment] = (cal_duty[down][1] - deadband) * ticks;
+            floor_work[down][segment] = target_work[down][segment];
         }
+    }
+}
 
-        break;
+// called from init_system: start from the defaults, then the table in flash if it is valid
+void load_calibration(void) {
 
-    // second floor, down button
-    case F2_DN:
+    unsigned char segment;
 
-        if (state == 'x') { // elevator is currently idle
+    motor_deadband[0] = motor_deadband[1] = MOTOR_DEADBAND;
+    for (segment = 0; segment < FLOOR_SEGMENTS; segment++) {
+        floor_work[0][segment] = UP_FLOOR_WORK;
+        floor_work[1][segment] = DN_FLOOR_WORK;
+        target_work[0][segment] = UP_TARGET_WORK;
+        target_work[1][segment] = DN_TARGET_WORK;
+    }
 
-            called_floor = 2;
-            dest_direction = 'd'; // elevator's destination is down
+#if BOOT_CALIBRATION
+    if (calibration_valid(CAL_FLASH) && !(P2IN & ELEV_EN)) {
+        apply_calibration(CAL_FLASH);
+    }
+    else {
+        cal_run = 0; // nothing stored, or a button held: calibrate once the car has homed
+    }
+#endif
+}
 
-            if (current_floor != 2) {
+#if BOOT_CALIBRATION
 
-                if (current_floor > 2) {
-                    go_down();
-                    state = 'v';
-                }
-                else {
-                    go_up();
-                    state = '^';
-                }
-            }
-            else {
-                state = 'w';
-            }
+unsigned int calibration_check(const struct calibration *table) {
+
+    const unsigned int *word = &table->magic;
+    unsigned int sum = 0;
+
+    while (word != &table->check) {
+        sum += *word++;
+    }
+    return ~sum;
+}
+
+// a table is only used if it is intact and every segment was timed in a plausible time:
+// a limit switch missed during the runs leaves its segment at 0, which would give it no
+// work to brake against or regulate to
+unsigned char calibration_valid(const struct calibration *table) {
+
+    const unsigned int *ticks = &table->ticks[0][0][0];
+    unsigned int count = 2 * CAL_RUNS * FLOOR_SEGMENTS;
+
+    if (table->magic != CAL_MAGIC || table->check != calibration_check(table)) {
+        return 0;
+    }
+    while (count--) {
+        if (*ticks == 0 || *ticks > CAL_TICKS_MAX) {
+            return 0;
         }
-        break;
+        ticks++;
+    }
+    return 1;
+}
 
-    // second floor, up button
-    case F2_UP:
+// erase a segment of information memory and program words into it
+// segment is volatile: the dummy write is overwritten by the first word, and no store may
+// move across the FCTL1 writes that select erase and program
+void write_info_flash(volatile unsigned int *segment, const unsigned int *words, unsigned int count) {
+
+    _disable_interrupts();
+    FCTL2 = FWKEY + FSSEL_1 + FN1;  // MCLK / 3, within the 257 - 476 kHz flash clock range
+    FCTL3 = FWKEY;                  // unlock
+    FCTL1 = FWKEY + ERASE;
+    *segment = 0;                   // a dummy write erases the segment
+    FCTL1 = FWKEY + WRT;
+    while (count--) {
+        *segment++ = *words++;
+    }
+    FCTL1 = FWKEY;
+    FCTL3 = FWKEY + LOCK;
+    _enable_interrupts();
+}
 
-        if (state == 'x') { // elevator is currently idle
+// called as a limit switch closes in state 'c': time the segment, turn at the ends
+void calibrate_floor(void) {
 
-            called_floor = 2;
-            dest_direction = 'u'; // elevator's destination is up
+    unsigned char down = (dest_direction == 'd');
+    unsigned char segment = down ? current_floor - 1 : current_floor - 2;
 
-            if (current_floor != 2) {
+    if (segment < FLOOR_SEGMENTS) {
+        cal.ticks[down][cal_run][segment] = cal_ticks;
+    }
+    cal_ticks = 0;
 
-                if (current_floor > 2) {
-                    go_down();
-                    state = 'v';
-                }
-                else {
-                    go_up();
-                    state = '^';
-                }
-            }
-            else {
-                state = 'w';
-            }
+    if (current_floor == (down ? 1 : NUM_FLOORS)) {
+
+        stop_motor();
+        dwell = CAL_PAUSE_TICKS;
+        dest_direction = down ? 'u' : 'd';
+        if (down) {
+            cal_run++; // back at the bottom, this run is done
         }
-        break;
+    }
+}
+
+// called on every WDT tick in state 'c'
+void calibrate_tick(void) {
+
+    if (dwell) {
+        stop_motor();
+        dwell--;
+        cal_ticks = 0;
+    }
+    else if (cal_run == CAL_RUNS) {
+        finish_calibration();
+    }
+    else {
+        if (dest_direction == 'd') {
+            go_down();
+        }
+        else {
+            go_up();
+        }
+        duty_out = cal_duty[dest_direction == 'd'][cal_run]; // fixed duty, no profile
+        cal_ticks++;
+    }
+}
 
-    // third floor, down button
-    case F3_DN:
+// store the table and start service
+// a table with a segment missing is dropped: the defaults stay, and so does whatever is in
+// flash, so a controller with no table calibrates again at the next boot
+void finish_calibration(void) {
+
+    cal.magic = CAL_MAGIC;
+    cal.check = calibration_check(&cal);
+    if (calibration_valid(&cal)) {
+        write_info_flash((volatile unsigned int *)CAL_FLASH, &cal.magic,
+                         sizeof(cal) / sizeof(unsigned int));
+        apply_calibration(&cal);
+    }
+    state = 'x';
+}
 
-        if (state == 'x') { // elevator is currently idle
+#endif // BOOT_CALIBRATION
 
-            called_floor = 3;
-            dest_direction = 'd';
+// ================ WARM RESTART ================
 
-            if (current_floor != 3) {
+#if WARM_RESTART
 
-                if (current_floor > 3) {
-                    go_down();
-                    state = 'v';
-                }
-                else {
-                    go_up();
-                    state = '^';
-                }
-            }
-            else {
-                state = 'w';
-            }
+// A reset (brown-out, watchdog) reinitializes the C variables but not RAM marked NOINIT.
+// After every pass of the main loop the car's floor, state, direction and pending calls
+// are kept there with a magic word and a checksum. At boot, if the record is intact and
+// the limit switch closed now is the one for the recorded floor, service resumes at once
+// instead of homing to the first floor. The riders' destinations are kept too. A boot
+// calibration pending only for want of a table then waits for the next cold start, but an
+// in-car button held through the reset still homes the car and calibrates it.
+
+#define WARM_MAGIC      0x5AFE
+
+struct warm_state {
+    unsigned int magic;
+    unsigned char floor;
+    unsigned char state;
+    unsigned char direction;
+    floor_mask_t hall_up, hall_dn, car;
+    unsigned char check;        // complement of the sum of the bytes above
+};
+
+NOINIT(warm) struct warm_state warm;
+
+unsigned char warm_check(void) {
+
+    const unsigned char *byte = (const unsigned char *)&warm;
+    unsigned char sum = 0;
+
+    while (byte != &warm.check) {
+        sum += *byte++;
+    }
+    return ~sum;
+}
+
+// called after every pass of the main loop
+void save_warm_state(void) {
+
+    if (state == 'i' || state == 'c') {
+        return; // position not known yet, keep the last record
+    }
+    warm.magic = WARM_MAGIC;
+    warm.floor = current_floor;
+    warm.state = state;
+    warm.direction = dest_direction;
+    warm.hall_up = hall_up_calls;
+    warm.hall_dn = hall_dn_calls;
+    warm.car = car_calls;
+    warm.check = warm_check();
+}
+
+// called from init_system: take up where the car was if a limit switch confirms it
+void warm_start(void) {
+
+    port_sample_t p2 = P2IN;
+
+    if (warm.magic != WARM_MAGIC || warm.check != warm_check()) {
+        return; // cold start, or the record did not survive
+    }
+    if (!(p2 & LIMIT_EN) || get_limit_addr(p2) + 1 != warm.floor) {
+        return; // the car is not where it was, home it
+    }
+#if BOOT_CALIBRATION
+    if (p2 & ELEV_EN) {
+        return; // asked for a calibration (see load_calibration), home first
+    }
+#endif
+
+    current_floor = warm.floor;
+    dest_direction = warm.direction;
+    hall_up_calls = warm.hall_up;
+    hall_dn_calls = warm.hall_dn;
+    car_calls = warm.car;
+
+    // a car stopped mid-trip is parked now, serve_next_call picks up its riders
+    if (warm.state == 'w') {
+        state = 'w';
+        dwell = DWELL_TICKS; // give the riders boarding here time to choose
+    }
+    else {
+        state = 'x';
+    }
+    update_display(current_floor);
+    commit_outputs();
+
+#if BOOT_CALIBRATION
+    cal_run = CAL_RUNS;
+#endif
+}
+
+#endif // WARM_RESTART
+
+// write every output whose shadow changed, one write per port
+// reloading TA0CCR1 with the same value mid-period can glitch the PWM, so it is left alone
+void commit_outputs(void) {
+
+    if (p2_out != p2_written) {
+        p2_written = p2_out;
+        P2OUT = p2_written;
+    }
+    if (duty_out != duty_written) {
+        duty_written = duty_out;
+        TA0CCR1 = duty_written;
+    }
+#if DEEP_IDLE
+    if (wake_starting) {
+        wake_starting = 0;
+        wake_latency = TA1R - wake_stamp;
+        if (wake_latency > wake_latency_max) {
+            wake_latency_max = wake_latency;
         }
-        break;
+    }
+#endif
+    if (p1_out != p1_written) {
+        p1_written = p1_out;
+        P1OUT = p1_written;
+    }
+}
 
-    // third floor, up button
-    case F3_UP:
+// ================ STATE TRACE ================
 
-        if (state == 'x') { // elevator is currently idle
+#if STATE_TRACE
 
-            called_floor = 3;
-            dest_direction = 'u';
+// Every event that changes the state adds one record to a ring in NOINIT RAM, so after
+// a misbehaviour, or the reset that ended it, the debugger can still read the last
+// TRACE_RECORDS changes with the tick and the input behind each one. The check is a
+// compare per event and the record four stores, all in main() rather than the handlers.
+// The tick count stands still while the car sleeps in LPM3.
 
-            if (current_floor != 3) {
+#define TRACE_MAGIC     0x7ACE
 
-                if (current_floor > 3) {
-                    go_down();
-                    state = 'v';
-                }
-                else {
-                    go_up();
-                    state = '^';
-                }
-            }
-            else {
-                state = 'w';
-            }
+NOINIT(trace) struct state_trace trace;
+
+unsigned int trace_tick;            // WDT ticks since reset
+
+// called from init_system: keep the trace of the last run and log the reset
+void trace_start(void) {
+
+    if (trace.magic != TRACE_MAGIC) {
+        trace.magic = TRACE_MAGIC; // cold start, nothing worth keeping
+        trace.head = 0;
+    }
+    trace_state(0, EV_TICK);
+}
+
+// log a change from state before to the current state, caused by the inputs in source
+// (EV_ bits): the encoders with a new press, or else the event being handled
+void trace_state(unsigned char before, unsigned char source) {
+
+    struct trace_record *r = &trace.record[trace.head & TRACE_MASK];
+
+    // once the ring is full head stays between TRACE_RECORDS and twice that, so it can
+    // never wrap back to looking empty
+    if (++trace.head == 2 * TRACE_RECORDS) {
+        trace.head = TRACE_RECORDS;
+    }
+
+    r->tick = trace_tick;
+    r->states = (before << 4) | (state & 0x0F);
+
+    // codes and floors past the six bits left over (tall host builds) are cut short
+    if (source & EV_LIMIT) {
+        r->input = TRACE_LIMIT | (input_code[IN_LIMIT] & ~TRACE_SOURCE);
+    }
+    else if (source & EV_ELEV) {
+        r->input = TRACE_ELEV | (input_code[IN_ELEV] & ~TRACE_SOURCE);
+    }
+    else if (source & EV_TOWER) {
+        r->input = TRACE_TOWER | (input_code[IN_TOWER] & ~TRACE_SOURCE);
+    }
+    else {
+        r->input = TRACE_TICK | (current_floor & ~TRACE_SOURCE);
+    }
+}
+
+#endif // STATE_TRACE
+
+// ================ 7-SEGMENT DISPLAY ================
+
+// The 74LS247 shows the code on SEVENSEG_A0..A2 (A3 is tied low), so codes 1 - 4 are the
+// floors and the spare codes carry status. Each glyph still renders as its digit.
+#define GLYPH_INIT      0   // looking for the first floor
+#define GLYPH_UP        5   // travelling up
+#define GLYPH_DOWN      6   // travelling down
+#define GLYPH_WAIT      7   // waiting for a destination
+#define GLYPH_NONE      0xFF
+
+#define SEVENSEG_MASK   (SEVENSEG_A0 + SEVENSEG_A1 + SEVENSEG_A2)
+
+// port 1 bits for each code, A2 is not next to A1
+const unsigned char sevenseg_bits[8] = {
+    0,
+    SEVENSEG_A0,
+    SEVENSEG_A1,
+    SEVENSEG_A1 + SEVENSEG_A0,
+    SEVENSEG_A2,
+    SEVENSEG_A2 + SEVENSEG_A0,
+    SEVENSEG_A2 + SEVENSEG_A1,
+    SEVENSEG_A2 + SEVENSEG_A1 + SEVENSEG_A0
+};
+
+#if DISPLAY_STATUS
+unsigned char display_ticks;    // WDT ticks, bit DISPLAY_FLASH selects floor or glyph
+#define DISPLAY_FLASH   0x40    // 64 ticks, about 0.5 s each
+#endif
+
+// show a code (floor or glyph) in one masked write of the shadow
+void update_display(unsigned char code) {
+
+    p1_out = (p1_out & ~SEVENSEG_MASK) | sevenseg_bits[code & 0x07];
+}
+
+#if DISPLAY_STATUS
+
+// glyph shown in turn with the floor, if any
+unsigned char status_glyph(void) {
+
+    switch (state) {
+    case '^':
+    case 'u':
+        return GLYPH_UP;
+    case 'v':
+    case 'd':
+        return GLYPH_DOWN;
+    case 'w':
+        return GLYPH_WAIT;
+    case 'c':
+        return GLYPH_INIT;
+    default:
+        return GLYPH_NONE; // 'i' shows GLYPH_INIT as floor 0
+    }
+}
+
+// called on every WDT tick: alternate the floor with the status glyph
+void update_status_display(void) {
+
+    unsigned char glyph = status_glyph();
+
+    display_ticks++;
+    if (glyph != GLYPH_NONE && (display_ticks & DISPLAY_FLASH)) {
+        update_display(glyph);
+    }
+    else {
+        update_display(current_floor);
+    }
+}
+
+#endif // DISPLAY_STATUS
+
+// ================ INPUT DEBOUNCING ================
+
+// A press is taken on the first sample that shows it, so a call costs no extra latency,
+// and a release only once the input has read released for DEBOUNCE_RELEASE samples in a
+// row. Contact bounce at make or at break is therefore seen as a single press. An encoder
+// whose address changes while EN stays high (a higher-priority input pressed on top)
+// counts as a release of the old input and a press of the new one.
+
+#define DEBOUNCE_RELEASE    6   // ~50 ms at 8 ms per tick
+
+volatile unsigned char input_code[INPUTS];      // debounced encoder address + 1, 0 when released
+volatile unsigned char input_quiet[INPUTS];     // consecutive samples read released
+volatile unsigned int input_held[INPUTS];       // ticks the current press has been held
+volatile unsigned int input_presses[INPUTS];    // presses and releases seen since reset
+volatile unsigned int input_releases[INPUTS];
+
+// encoder outputs as debouncer codes: address + 1 while EN is high, 0 otherwise
+unsigned char tower_code(port_sample_t p1) {
+
+    return (p1 & TOWER_EN) ? get_tower_addr(p1) + 1 : 0;
+}
+
+unsigned char elev_code(port_sample_t p2) {
+
+    return (p2 & ELEV_EN) ? get_elev_addr(p2) + 1 : 0;
+}
+
+unsigned char limit_code(port_sample_t p2) {
+
+    return (p2 & LIMIT_EN) ? get_limit_addr(p2) + 1 : 0;
+}
+
+// feed one sample of an encoder into its debouncer
+// returns the code when a new press starts, 0 otherwise
+unsigned char debounce(unsigned char input, unsigned char code) {
+
+    if (!code) {
+
+        // a release is believed only once it has lasted
+        if (input_code[input] && ++input_quiet[input] >= DEBOUNCE_RELEASE) {
+            input_code[input] = 0;
+            input_releases[input]++;
         }
-        break;
+        return 0;
+    }
 
-    // fourth floor, down button
-    case F4_DN:
+    input_quiet[input] = 0;
 
-        if (state == 'x') { // elevator is currently idle
+    if (code == input_code[input]) {
+        return 0; // still the same press, or a bounce of it
+    }
+    if (input_code[input]) {
+        input_releases[input]++;
+    }
+    input_code[input] = code;
+    input_held[input] = 0;
+    input_presses[input]++;
+    return code;
+}
 
-            called_floor = 4;
-            dest_direction = 'd';
+// decode the encoders in which (EV_ bits) from one sample of both ports, and pass every
+// new press on to its handler, returns the EV_ bits of the encoders that had one
+// all encoders come from the same sample, so an EN bit and its address always agree
+unsigned char read_encoders(port_sample_t p1, port_sample_t p2, unsigned char which) {
 
-            if (current_floor != 4) {
+    unsigned char code, pressed = 0;
 
-                go_up();
-                state = '^';
-            }
-            else {
-                state = 'w';
-            }
+    if (which & EV_LIMIT) {
+
+        code = debounce(IN_LIMIT, limit_code(p2));
+        if (code) {
+            handle_limit_switch(code - 1); // limit switch depressed
+            pressed |= EV_LIMIT;
         }
-        break;
-    } // switch
+    }
+    if (which & EV_ELEV) {
+
+        code = debounce(IN_ELEV, elev_code(p2));
+        if (code) {
+            handle_elev_button(code - 1); // in-elevator button pressed
+            pressed |= EV_ELEV;
+        }
+    }
+    if (which & EV_TOWER) {
+
+        code = debounce(IN_TOWER, tower_code(p1));
+        if (code) {
+            handle_tower_button(code - 1); // on-tower button pressed
+            pressed |= EV_TOWER;
+        }
+    }
+    return pressed;
+}
+
+// ================ CONTROL HANDLERS ================
+
+// get the address of the on-tower button that was pressed from a sample of P1IN
+unsigned char get_tower_addr(port_sample_t p1) {
+
+    // right shift the address bits into LSB position
+    return ((p1 & TOWER_ADDR_MASK) >> TOWER_ADDR_SHIFT);
+}
+
+// get the address of the in-elevator button that was pressed from a sample of P2IN
+unsigned char get_elev_addr(port_sample_t p2) {
+
+    return ((p2 & ELEV_ADDR_MASK) >> ELEV_ADDR_SHIFT);
+}
+
+// get the address of the limit switch that was pressed from a sample of P2IN
+unsigned char get_limit_addr(port_sample_t p2) {
+
+    return ((p2 & LIMIT_ADDR_MASK) >> LIMIT_ADDR_SHIFT);
+}
+
+// on-tower call button map, indexed by encoder address (see TOWER_ADDR in elevator.h)
+// each entry is the floor the button is on, with TOWER_DOWN set for a down button,
+// or 0 for an address with no button wired to it
+#define TOWER_DOWN          0x80
+#define TOWER_FLOOR_MASK    0x7F
+
+#define TOWER_ENTRY(addr)   (TOWER_ADDR_USED(addr) ? \
+                             TOWER_ADDR_FLOOR(addr) | (TOWER_ADDR_DOWN(addr) ? TOWER_DOWN : 0) : 0),
+
+#define TOWER_REPEAT_2(i)   TOWER_ENTRY(i) TOWER_ENTRY((i) + 1)
+#define TOWER_REPEAT_4(i)   TOWER_REPEAT_2(i) TOWER_REPEAT_2((i) + 2)
+#define TOWER_REPEAT_8(i)   TOWER_REPEAT_4(i) TOWER_REPEAT_4((i) + 4)
+#define TOWER_REPEAT_16(i)  TOWER_REPEAT_8(i) TOWER_REPEAT_8((i) + 8)
+#define TOWER_REPEAT_32(i)  TOWER_REPEAT_16(i) TOWER_REPEAT_16((i) + 16)
+#define TOWER_REPEAT_64(i)  TOWER_REPEAT_32(i) TOWER_REPEAT_32((i) + 32)
+#define TOWER_REPEAT_128(i) TOWER_REPEAT_64(i) TOWER_REPEAT_64((i) + 64)
+
+const unsigned char tower_map[1 << TOWER_ADDR_BITS] = {
+#if TOWER_ADDR_BITS == 1
+    TOWER_REPEAT_2(0)
+#elif TOWER_ADDR_BITS == 2
+    TOWER_REPEAT_4(0)
+#elif TOWER_ADDR_BITS == 3
+    TOWER_REPEAT_8(0)
+#elif TOWER_ADDR_BITS == 4
+    TOWER_REPEAT_16(0)
+#elif TOWER_ADDR_BITS == 5
+    TOWER_REPEAT_32(0)
+#elif TOWER_ADDR_BITS == 6
+    TOWER_REPEAT_64(0)
+#else
+    TOWER_REPEAT_128(0)
+#endif
+};
+
+// records a call requesting the elevator to a specific floor
+// the call stays pending until the car stops there in the requested direction
+void handle_tower_button(unsigned char addr) {
+
+    unsigned char button = tower_map[addr];
+
+    if (button & TOWER_DOWN) {
+        hall_dn_calls |= FLOOR_BIT(button & TOWER_FLOOR_MASK);
+    }
+    else if (button) {
+        hall_up_calls |= FLOOR_BIT(button);
+    }
+
+    // a press for the direction the car is already boarding here is answered on the spot
+    if (state == 'w') {
+        answer_hall_call();
+    }
 }
 
 // in-elevator call button addresses
@@ -457,23 +1421,49 @@ void handle_tower_button(unsigned char addr) {
 #define F4_SELECTED   0x30
 
 // handles a call event where the elevator passenger selected a destination floor
+// every destination is added to the pending car calls, those behind the car are served
+// once it turns round (see RIDER_REVERSAL)
 void handle_elev_button(unsigned char addr) {
 
-    destination = addr + 1; // valid destinations are 1 - 4
+    unsigned char destination = addr + 1; // valid destinations are 1 - NUM_FLOORS
 
-    if (state == 'w') { // waiting for user to select destination
+    if (addr >= NUM_FLOORS) {
+        return; // no button wired to this address, as for TOWER_ADDR_USED
+    }
 
+    switch (state) {
+    case 'w': // waiting for user to select destination
+    case 'x':
         if (destination == current_floor) {
-            state = 'w'; // already at destination
+            return; // already there
         }
-        else if (dest_direction == 'u' && (destination > current_floor)) {
+        break;
+    case '^':
+    case 'u':
+    case 'v':
+    case 'd':
+        break;
+    default:
+        return; // position not known yet
+    }
 
-            state = 'u'; // going up with passenger
-        }
-        else if (dest_direction == 'd' && (destination < current_floor)) {
+#if RIDER_REVERSAL
+    // nobody aboard is going the way the car was called for, so turn round for this rider
+    // and take on anyone waiting here to go the same way
+    if (state == 'w' && !((car_calls | FLOOR_BIT(destination)) & floors_ahead())) {
+        dest_direction = (dest_direction == 'u') ? 'd' : 'u';
+        answer_hall_call();
+    }
+#endif
 
-            state = 'd'; // going down with passenger
-        }
+    car_calls |= FLOOR_BIT(destination);
+
+    // a car on its way to a hall call now carries a rider too
+    if (state == '^') {
+        state = 'u';
+    }
+    else if (state == 'v') {
+        state = 'd';
     }
 }
 
@@ -485,36 +1475,397 @@ void handle_elev_button(unsigned char addr) {
 #define LIMIT_4    0x03
 
 // handles the event where a limit switch on the tower is depressed, indicating elevator position
+// a moving car decides here whether this floor is one of its stops
 void handle_limit_switch(unsigned char addr) {
 
-    current_floor = addr + 1; // valid floors are 1 - 4
+    if (addr >= NUM_FLOORS) {
+        return; // no switch wired to this address, keep the last known floor
+    }
+    current_floor = addr + 1; // valid floors are 1 - NUM_FLOORS
 
-    if (current_floor == 1 || current_floor == 4) {
+    if (current_floor == 1 || current_floor == NUM_FLOORS) {
 
         stop_motor(); // redundant, ensure elevator does not travel past structural limits
     }
     update_display(current_floor);
+
+    if (state == '^' || state == 'v' || state == 'u' || state == 'd') {
+
+        learn_floor_work();
+
+#if COLLECTIVE_CONTROL
+        take_next_action(1);
+#else
+        // stop for the target, or for a rider's floor on the way
+        if (target_floor == current_floor || (car_calls & FLOOR_BIT(current_floor))) {
+            stop_motor();
+            arrive();
+        }
+#endif
+    }
+#if BOOT_CALIBRATION
+    else if (state == 'c') {
+        calibrate_floor();
+    }
+#endif
 }
 
-// ================ WDT INTERRUPT HANDLER ================
+// ================ DISPATCH ================
 
-interrupt void WDT_interval_handler() {
+// the pending hall call at the current floor in direction dir, if any
+unsigned char hall_call_here(unsigned char dir) {
+
+    return (((dir == 'u') ? hall_up_calls : hall_dn_calls) & FLOOR_BIT(current_floor)) != 0;
+}
+
+// nearest floor beyond the car in direction dir with any pending call, 0 if there is none
+unsigned char next_call_ahead(unsigned char dir) {
+
+    floor_mask_t pending = hall_up_calls | hall_dn_calls | car_calls;
+
+    if (dir == 'u') {
+        return lowest_floor(pending & FLOORS_ABOVE(current_floor));
+    }
+    return highest_floor(pending & FLOORS_BELOW(current_floor));
+}
+
+// number of floors between the car and floor
+unsigned char floor_distance(unsigned char floor) {
+
+    return (floor > current_floor) ? floor - current_floor : current_floor - floor;
+}
+
+// find the pending call closest to the car, 0 if there is none
+// ties go to the floor in the current direction of travel
+unsigned char nearest_call(floor_mask_t calls) {
+
+    unsigned char above = lowest_floor(calls & FLOORS_ABOVE(current_floor));
+    unsigned char below = highest_floor(calls & FLOORS_BELOW(current_floor));
+
+    if (calls & FLOOR_BIT(current_floor)) {
+        return current_floor;
+    }
+    if (!below) {
+        return above;
+    }
+    if (!above) {
+        return below;
+    }
+    if (floor_distance(above) == floor_distance(below)) {
+        return (dest_direction == 'u') ? above : below;
+    }
+    return (floor_distance(above) < floor_distance(below)) ? above : below;
+}
+
+// floors beyond the car in the direction it is heading
+floor_mask_t floors_ahead(void) {
+
+    return (dest_direction == 'u') ? FLOORS_ABOVE(current_floor) : FLOORS_BELOW(current_floor);
+}
+
+// clear the hall call the car just stopped for
+void answer_hall_call(void) {
+
+    if (dest_direction == 'u') {
+        hall_up_calls &= ~FLOOR_BIT(current_floor);
+    }
+    else {
+        hall_dn_calls &= ~FLOOR_BIT(current_floor);
+    }
+}
+
+// start moving towards floor, which must differ from current_floor
+void depart(unsigned char floor) {
+
+    target_floor = floor;
+    if (state == 'x' || state == 'w') {
+        start_profile(); // starting from rest, not changing state on the way
+    }
+
+    if (floor > current_floor) {
+        dest_direction = 'u';
+        state = car_calls ? 'u' : '^';
+        go_up();
+    }
+    else {
+        dest_direction = 'd';
+        state = car_calls ? 'd' : 'v';
+        go_down();
+    }
+}
+
+#if COLLECTIVE_CONTROL
+
+// ================ NEXT-ACTION TABLE ================
+
+// Every collective-control decision, whether the car is passing a floor or parked at one,
+// depends only on a few facts about the pending calls relative to the car. These are
+// packed into an 8-bit index, and the answer for every index is computed by the
+// preprocessor into a table in flash, so a decision is a single load.
+//
+// NA_AHEAD and NA_BEHIND fold the pending masks around current_floor, which makes the
+// table independent of the floor count.
+
+// index bits
+#define NA_DOWN         0x01    // car is heading down
+#define NA_MOVING       0x02    // car is passing this floor rather than parked at it
+#define NA_CAR_HERE     0x04    // car call for this floor
+#define NA_HALL_SAME    0x08    // hall call here in the direction the car is heading
+#define NA_HALL_OPP     0x10    // hall call here in the other direction
+#define NA_AHEAD        0x20    // any call beyond this floor in the direction the car is heading
+#define NA_BEHIND       0x40    // any call beyond this floor in the other direction
+#define NA_RIDERS       0x80    // car calls pending anywhere
+
+// entry: the next state, with NA_HEAD_DOWN set if the car heads down afterwards
+#define NA_HEAD_DOWN    0x80
+
+// a moving car passes a floor nobody wants while there is more to do ahead
+#define NA_PASS(i)  (((i) & NA_MOVING) && !((i) & (NA_CAR_HERE | NA_HALL_SAME)) && \
+                     ((i) & NA_AHEAD))
+
+// at a stop the car reverses once nothing is left here or ahead in its direction (LOOK)
+#define NA_REVERSE(i)       (!((i) & (NA_HALL_SAME | NA_AHEAD)) && ((i) & (NA_HALL_OPP | NA_BEHIND)))
+#define NA_DOWN_AFTER(i)    (((i) & NA_DOWN) ? !NA_REVERSE(i) : NA_REVERSE(i))
+#define NA_BOARD_AFTER(i)   ((i) & (NA_REVERSE(i) ? NA_HALL_OPP : NA_HALL_SAME))
+#define NA_AHEAD_AFTER(i)   ((i) & (NA_REVERSE(i) ? NA_BEHIND : NA_AHEAD))
+
+// travelling state for a direction, with or without riders aboard
+#define NA_TRAVEL(down, i)  ((down) ? (((i) & NA_RIDERS) ? 'd' : 'v') : \
+                                      (((i) & NA_RIDERS) ? 'u' : '^'))
+
+// passing:     keep travelling
+// stopping:    board anyone going our way ('w'), otherwise let riders off ('x')
+// parked:      board here, else leave for the next call ahead, else stay idle
+#define NEXT_ACTION(i) \
+    (NA_PASS(i) ? \
+        (NA_TRAVEL((i) & NA_DOWN, i) | (((i) & NA_DOWN) ? NA_HEAD_DOWN : 0)) : \
+        ((NA_DOWN_AFTER(i) ? NA_HEAD_DOWN : 0) | \
+         (NA_BOARD_AFTER(i) ? 'w' : \
+          ((i) & NA_MOVING) ? 'x' : \
+          NA_AHEAD_AFTER(i) ? NA_TRAVEL(NA_DOWN_AFTER(i), i) : 'x')))
+
+#define NA_REPEAT_4(m, i)   m(i) m((i) + 1) m((i) + 2) m((i) + 3)
+#define NA_REPEAT_16(m, i)  NA_REPEAT_4(m, i) NA_REPEAT_4(m, (i) + 4) \
+                            NA_REPEAT_4(m, (i) + 8) NA_REPEAT_4(m, (i) + 12)
+#define NA_REPEAT_64(m, i)  NA_REPEAT_16(m, i) NA_REPEAT_16(m, (i) + 16) \
+                            NA_REPEAT_16(m, (i) + 32) NA_REPEAT_16(m, (i) + 48)
+#define NA_REPEAT_256(m)    NA_REPEAT_64(m, 0) NA_REPEAT_64(m, 64) \
+                            NA_REPEAT_64(m, 128) NA_REPEAT_64(m, 192)
+
+#define NA_ENTRY(i)     NEXT_ACTION(i),
+
+const unsigned char next_action[256] = { NA_REPEAT_256(NA_ENTRY) };
+
+// compile-time verification, each rule counts the entries that break it:
+// 1. a car never passes a floor with a car call or a hall call in its direction
+// 2. a car never travels towards a side with nothing pending
+// 3. a parked car never stays idle while anything is pending
+// 4. a car only stops to board when someone is waiting here in its new direction
+#define NA_STATE(i)     (NEXT_ACTION(i) & ~NA_HEAD_DOWN)
+#define NA_TRAVELS(i)   (NA_STATE(i) != 'w' && NA_STATE(i) != 'x')
+#define NA_HEADS_DOWN(i) ((NEXT_ACTION(i) & NA_HEAD_DOWN) != 0)
+#define NA_TOWARDS(i)   ((i) & ((NA_HEADS_DOWN(i) == !!((i) & NA_DOWN)) ? NA_AHEAD : NA_BEHIND))
+#define NA_WAITING(i)   ((i) & ((NA_HEADS_DOWN(i) == !!((i) & NA_DOWN)) ? NA_HALL_SAME : NA_HALL_OPP))
+
+#define NA_BROKEN(i) \
+    (NA_TRAVELS(i) && ((i) & NA_MOVING) && ((i) & (NA_CAR_HERE | NA_HALL_SAME))) + \
+    (NA_TRAVELS(i) && !NA_TOWARDS(i)) + \
+    (!((i) & NA_MOVING) && NA_STATE(i) == 'x' && \
+     ((i) & (NA_HALL_SAME | NA_HALL_OPP | NA_AHEAD | NA_BEHIND))) + \
+    (NA_STATE(i) == 'w' && !NA_WAITING(i)) +
+
+typedef char next_action_verified[(NA_REPEAT_256(NA_BROKEN) 0) == 0 ? 1 : -1];
+
+// look up and carry out the next action at the current floor
+// moving is set when the car is passing the floor, clear when it is parked there
+void take_next_action(unsigned char moving) {
+
+    floor_mask_t here = FLOOR_BIT(current_floor);
+    floor_mask_t above = FLOORS_ABOVE(current_floor), below = FLOORS_BELOW(current_floor);
+    floor_mask_t pending = hall_up_calls | hall_dn_calls | car_calls;
+    unsigned char index = moving ? NA_MOVING : 0, next;
+
+    if (dest_direction == 'u') {
+        index |= ((hall_up_calls & here) ? NA_HALL_SAME : 0) |
+                 ((hall_dn_calls & here) ? NA_HALL_OPP : 0) |
+                 ((pending & above) ? NA_AHEAD : 0) |
+                 ((pending & below) ? NA_BEHIND : 0);
+    }
+    else {
+        index |= NA_DOWN |
+                 ((hall_dn_calls & here) ? NA_HALL_SAME : 0) |
+                 ((hall_up_calls & here) ? NA_HALL_OPP : 0) |
+                 ((pending & below) ? NA_AHEAD : 0) |
+                 ((pending & above) ? NA_BEHIND : 0);
+    }
+    index |= ((car_calls & here) ? NA_CAR_HERE : 0) | (car_calls ? NA_RIDERS : 0);
+
+    next = next_action[index];
+    dest_direction = (next & NA_HEAD_DOWN) ? 'd' : 'u';
+    next &= ~NA_HEAD_DOWN;
+
+    if (next == state) {
+        return; // passing the floor, or idle with nothing to do
+    }
+
+    if (next == 'w' || next == 'x') {
+
+        stop_motor();
+
+        if (moving) {
+            // stopped here, let riders off
+            car_calls &= ~here;
+            dwell = DWELL_TICKS;
+        }
+        if (next == 'w') {
+            answer_hall_call(); // waiting for the new riders to select a floor
+        }
+        state = next;
+    }
+    else {
+        depart(next_call_ahead(dest_direction));
+    }
+}
+
+// take the next pending call while idle
+void serve_next_call(void) {
+
+    car_calls &= ~FLOOR_BIT(current_floor); // nothing to do for a destination the car is already at
+    take_next_action(0);
+}
+
+#else
+
+// the car has reached target_floor, let riders off and anyone waiting here on
+void arrive(void) {
+
+    unsigned char reverse = (dest_direction == 'u') ? 'd' : 'u';
+
+    car_calls &= ~FLOOR_BIT(current_floor);
+    dwell = DWELL_TICKS;
+
+    // pick up someone waiting to go the other way if nothing is pending further on
+    if (!hall_call_here(dest_direction) && !next_call_ahead(dest_direction) &&
+        hall_call_here(reverse)) {
+        dest_direction = reverse;
+    }
+
+    if (hall_call_here(dest_direction)) {
+        answer_hall_call();
+        state = 'w'; // waiting for the new riders to select a floor
+    }
+    else {
+        state = 'x';
+    }
+}
+
+// take the next pending call while idle
+// riders already in the car come first, then the nearest hall call
+void serve_next_call(void) {
+
+    unsigned char floor, up, dn, dir;
+
+    floor = nearest_call(car_calls);
+
+    if (floor) {
+
+        if (floor == current_floor) {
+            car_calls &= ~FLOOR_BIT(floor); // nothing to do, already here
+        }
+        else {
+            depart(floor);
+        }
+        return;
+    }
+
+    up = nearest_call(hall_up_calls);
+    dn = nearest_call(hall_dn_calls);
+
+    // take the closer hall call, the up call on a tie
+    if (up && (!dn || floor_distance(up) <= floor_distance(dn))) {
+        floor = up;
+        dir = 'u';
+    }
+    else if (dn) {
+        floor = dn;
+        dir = 'd';
+    }
+    else {
+        return; // no calls pending
+    }
+
+    if (floor != current_floor) {
+        depart(floor);
+    }
+    dest_direction = dir; // direction of the call, not of travel
 
-    // poll the sensors to check for user input
-    if (P2IN & LIMIT_EN) {
+    if (floor == current_floor) {
 
-        // limit switch depressed
-        handle_limit_switch(get_limit_addr());
+        // called to the floor the car is already at
+        answer_hall_call();
+        state = 'w';
     }
-    if (P2IN & ELEV_EN) {
+}
+
+#endif // COLLECTIVE_CONTROL
+
+// ================ CONTROL LOOP ================
+
+// one WDT tick's worth of work on the inputs sampled at that tick, returns the EV_ bits
+// of the encoders that had a new press
+unsigned char control_tick(port_sample_t p1, port_sample_t p2) {
+
+    unsigned char i, pressed, which = EV_ENCODERS;
+#if INPUT_IRQ
+    unsigned char rearm1 = 0, rearm2 = 0;
 
-        // in-elevator button pressed
-        handle_elev_button(get_elev_addr());
+    // an armed line is released and reports its next press itself, so only the encoders
+    // held since their interrupt masked itself are polled
+    if (P2IE & LIMIT_EN) {
+        which &= ~EV_LIMIT;
+    }
+    if (P2IE & ELEV_EN) {
+        which &= ~EV_ELEV;
+    }
+    if (P1IE & TOWER_EN) {
+        which &= ~EV_TOWER;
+    }
+#endif
+
+    // check the sampled sensors for new presses
+    pressed = read_encoders(p1, p2, which);
+
+#if INPUT_IRQ
+    // listen for the next edge on every line released for good
+    // the flags are left alone: an edge latched since this tick's sample may be a new press,
+    // and a stale one only costs an interrupt whose sample the debouncer finds released
+    if (!input_code[IN_LIMIT]) {
+        rearm2 |= LIMIT_EN;
+    }
+    if (!input_code[IN_ELEV]) {
+        rearm2 |= ELEV_EN;
+    }
+    if (!input_code[IN_TOWER]) {
+        rearm1 |= TOWER_EN;
+    }
+    rearm2 &= ~P2IE;
+    rearm1 &= ~P1IE;
+    P2IE |= rearm2;
+    P1IE |= rearm1;
+#endif
+
+    for (i = 0; i < INPUTS; i++) {
+        if (input_code[i] && input_held[i] != 0xFFFF) {
+            input_held[i]++;
+        }
+    }
+    // the car moved through the last tick on the profile at ramp_duty
+    if (!(p2_out & UPCTL) != !(p2_out & DNCTL) && ramp_duty > motor_deadband[TRAVELLING_DOWN]) {
+        travel_work += ramp_duty - motor_deadband[TRAVELLING_DOWN];
     }
-    if (P1IN & TOWER_EN) {
 
-        // on-tower button pressed
-        handle_tower_button(get_tower_addr());
+    if (state != 'w') {
+        wait_ticks = 0;
     }
 
     // handle system state
@@ -527,6 +1878,13 @@ interrupt void WDT_interval_handler() {
             // elevator initialized to first floor, ready for service
             stop_motor();
             state = 'x';
+#if BOOT_CALIBRATION
+            if (cal_run < CAL_RUNS) {
+                state = 'c';
+                dest_direction = 'u';
+                dwell = CAL_PAUSE_TICKS; // let the car settle first
+            }
+#endif
         }
         else {
 
@@ -535,62 +1893,301 @@ interrupt void WDT_interval_handler() {
         }
         break;
 
-    case 'x': // elevator idle
+#if BOOT_CALIBRATION
+    case 'c': // timing the shaft after a reset
 
-        // do nothing for now
-        stop_motor();
+        calibrate_tick();
         break;
+#endif
 
-    case '^': // *up arrow* going up to called floor
+    case 'x': // elevator idle
 
-        if (called_floor == current_floor) {
-            stop_motor();
-            state = 'w';
+        stop_motor();
+
+        // let riders off before leaving for the next call
+        if (dwell) {
+            dwell--;
         }
         else {
-            go_up();
+            serve_next_call();
+#if DEEP_IDLE
+            if (state == 'x') {
+                sleep_deep(); // nothing to do until a button is pressed
+            }
+#endif
         }
         break;
 
+    case '^': // *up arrow* going up to called floor
+    case 'u': // going up with passenger
+
+        // stops are decided as each limit switch closes
+        go_up();
+        break;
+
     case 'v': // *down arrow* going down to called floor
+    case 'd': // going down with passenger
 
-        if (called_floor == current_floor) {
-            stop_motor();
-            state = 'w';
-        }
-        else {
-            go_down();
-        }
+        go_down();
         break;
 
     case 'w':
 
-        // waiting for user input
+        // waiting for user input, leave once a destination is selected
         stop_motor();
-        break;
-
-    case 'u': // going up with passenger
 
-        if (destination == current_floor) {
-            stop_motor();
-            state = 'x';
+        if (dwell) {
+            dwell--;
         }
-        else {
-            go_up();
+        else if (car_calls) {
+#if COLLECTIVE_CONTROL
+            take_next_action(0); // destinations behind wait for the end of the sweep
+            if (state == 'w') {
+                // turned round to board those waiting here to go the other way
+                answer_hall_call();
+                dwell = DWELL_TICKS;
+            }
+#else
+            // the nearest destination the way the car was called for, then the others
+            depart(nearest_call((car_calls & floors_ahead()) ? (car_calls & floors_ahead())
+                                                             : car_calls));
+#endif
+        }
+#if COLLECTIVE_CONTROL
+        else if (hall_up_calls | hall_dn_calls) {
+            state = 'x'; // nobody selected a floor and others are waiting, carry on
+        }
+#endif
+        else if (++wait_ticks >= WAIT_TIMEOUT_TICKS) {
+            state = 'x'; // nobody selected a floor in time, drop the request
         }
         break;
 
-    case 'd': // going down with passenger
+    } // switch
 
-        if (destination == current_floor) {
-            stop_motor();
-            state = 'x';
+#if DISPLAY_STATUS
+    update_status_display();
+#endif
+    return pressed;
+}
+
+// handle every queued event, oldest first, then update the outputs once
+void run_events(void) {
+
+    while (event_tail != event_head) {
+
+        unsigned char i = event_tail, type = event_type[i];
+#if STATE_TRACE
+        unsigned char before = state, pressed;
+#endif
+#if PROFILE_EVENTS
+        unsigned char path = event_path(type);
+        unsigned int start = TA1R;
+#endif
+
+        if (type & EV_TICK) {
+#if STATE_TRACE
+            pressed =
+#endif
+            control_tick(event_p1[i], event_p2[i]);
         }
         else {
-            go_down();
+#if STATE_TRACE
+            pressed =
+#endif
+            read_encoders(event_p1[i], event_p2[i], type);
+#if DEEP_IDLE
+            if (type & (EV_TOWER + EV_ELEV)) {
+                wake_up();
+            }
+#endif
         }
-        break;
 
-    } // switch
+#if PROFILE_EVENTS
+        profile_path(path, start);
+#endif
+#if STATE_TRACE
+        if (type & EV_TICK) {
+            trace_tick++;
+        }
+        if (state != before) {
+            trace_state(before, pressed ? pressed : type); // log the press behind it if any
+        }
+#endif
+        // release the slot only once it has been read
+        event_tail = (i + 1) & EVENT_MASK;
+    }
+
+    commit_outputs();
+#if WARM_RESTART
+    save_warm_state();
+#endif
+}
+
+// one pass of the main loop: sleep until an interrupt queues an event, then handle it
+void main_loop(void) {
+
+    // interrupts stay off between the check and the sleep, so an event queued in that
+    // window cannot be missed; _bis_SR_register enables them and sleeps in one instruction
+    _disable_interrupts();
+
+    if (event_tail == event_head) {
+#if DEEP_IDLE
+        _bis_SR_register(GIE + (deep_idle ? LPM3_bits : LPM0_bits));
+#else
+        _bis_SR_register(GIE + LPM0_bits);
+#endif
+    }
+    _enable_interrupts();
+
+    run_events();
+}
+
+// ================ PROFILING ================
+
+#if PROFILE_EVENTS
+
+// Every handler, and the work main() does for each event, is timed on timer A1, which
+// counts SMCLK cycles. With the 8 ms WDT interval a tick leaves 8192 cycles for all of it.
+// An interrupt taken while main() handles an event is counted in that event too, so the
+// maxima are what the loop really needs, not just its own code. Nothing is sent anywhere:
+// both ports are fully wired, the USCI pins included, so the table is read by the
+// debugger instead (host/profile_dump.c).
+
+struct path_profile profile[PATHS];
+
+// profile path for an event, taken before it is handled
+unsigned char event_path(unsigned char type) {
+
+    const char *s = PATH_STATES;
+    unsigned char i;
+
+    if (!(type & EV_TICK)) {
+        return (type & EV_LIMIT) ? PATH_LIMIT : (type & EV_ELEV) ? PATH_ELEV : PATH_TOWER;
+    }
+    for (i = 0; s[i + 1] && s[i] != state; i++) {
+        // every state is listed
+    }
+    return PATH_TICK + i;
+}
+
+// add a run of path that began when TA1R read start
+void profile_path(unsigned char path, unsigned int start) {
+
+    unsigned int t = TA1R - start;
+    struct path_profile *p = &profile[path];
+
+    if (!p->count || t < p->min) {
+        p->min = t;
+    }
+    if (t > p->max) {
+        p->max = t;
+    }
+    if (p->count != 0xFFFF) {
+        p->count++;
+        p->sum += t;
+    }
+}
+
+#endif // PROFILE_EVENTS
+
+// ================ INTERRUPT HANDLERS ================
+
+// The handlers only sample the ports into the event queue and wake main(), so each one
+// runs in a short, fixed time whatever the state machine is doing. Interrupts do not nest,
+// so the handlers together are the single producer and main() the single consumer.
+
+// add an event with a snapshot of both input ports, dropped if the queue is full
+// each port is read exactly once per event, and every encoder is decoded from that read
+void queue_event(unsigned char type) {
+
+    unsigned char i = event_head, next = (i + 1) & EVENT_MASK;
+
+    if (next == event_tail) {
+        events_dropped++;
+        return;
+    }
+    event_type[i] = type;
+    event_p1[i] = P1IN;
+    event_p2[i] = P2IN;
+
+    // publish the slot only once it has been written
+    event_head = next;
+}
+
+// record how long a handler took, in SMCLK cycles
+#if PROFILE_EVENTS
+#define ISR_TIMED(start, path) \
+    do { \
+        unsigned int t = TA1R - (start); \
+        if (t > isr_time_max) { \
+            isr_time_max = t; \
+        } \
+        profile_path(path, start); \
+    } while (0)
+#else
+#define ISR_TIMED(start, path) \
+    do { \
+        unsigned int t = TA1R - (start); \
+        if (t > isr_time_max) { \
+            isr_time_max = t; \
+        } \
+    } while (0)
+#endif
+
+interrupt void WDT_interval_handler() {
+
+    unsigned int start = TA1R;
+
+    queue_event(EV_TICK);
+    _bic_SR_register_on_exit(LPM3_bits); // wake main()
+    ISR_TIMED(start, PATH_WDT_IRQ);
 }
 ISR_VECTOR(WDT_interval_handler, ".int10")
+
+#if INPUT_IRQ
+
+// an EN line went high: queue the press right away, then leave the line to the WDT
+// until it is released so a bouncing contact cannot flood the CPU with interrupts
+
+interrupt void PORT1_handler() {
+
+    unsigned int start = TA1R;
+
+#if DEEP_IDLE
+    wake_stamp = start; // timer A1 stood still with SMCLK while asleep
+#endif
+    // a masked line still latches its flag, so only enabled lines count
+    if (P1IFG & P1IE & TOWER_EN) {
+
+        P1IE &= ~TOWER_EN;
+        P1IFG &= ~TOWER_EN;
+        queue_event(EV_TOWER);
+    }
+    _bic_SR_register_on_exit(LPM3_bits);
+    ISR_TIMED(start, PATH_PORT1_IRQ);
+}
+ISR_VECTOR(PORT1_handler, ".int02")
+
+interrupt void PORT2_handler() {
+
+    unsigned int start = TA1R;
+    unsigned char fired;
+
+#if DEEP_IDLE
+    wake_stamp = start;
+#endif
+    // one event for both lines, so both encoders are decoded from a single sample
+    fired = P2IFG & P2IE & (LIMIT_EN + ELEV_EN);
+    if (fired) {
+
+        P2IE &= ~fired;
+        P2IFG &= ~fired;
+        queue_event(((fired & LIMIT_EN) ? EV_LIMIT : 0) + ((fired & ELEV_EN) ? EV_ELEV : 0));
+    }
+    _bic_SR_register_on_exit(LPM3_bits);
+    ISR_TIMED(start, PATH_PORT2_IRQ);
+}
+ISR_VECTOR(PORT2_handler, ".int03")
+
+#endif // INPUT_IRQ